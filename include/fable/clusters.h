@@ -0,0 +1,408 @@
+#ifndef FABLE_CLUSTERS_H
+#define FABLE_CLUSTERS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "fable/fable.h"
+
+/*
+ * Clustered forward lighting
+ *
+ * The view frustum is cut into CLUSTER_X by CLUSTER_Y screen tiles and
+ * CLUSTER_Z depth slices, spaced exponentially between the near and far
+ * planes. Every point and spot light is binned on the CPU into the
+ * clusters its bounding sphere may touch, and lit.frag only evaluates the
+ * lights of the fragment's own cluster
+ *
+ * Three buffer textures carry the result:
+ * - lights: CLUSTER_LIGHT_TEXELS RGBA32F texels per light
+ * - grid: per cluster, offset and count of its run in the index list
+ * - indices: light indices, one run per cluster
+ * */
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+/*
+ * Light indices are stored as 16 bit
+ * */
+#define CLUSTER_MAX_LIGHTS 0xFFFF
+
+/*
+ * Texture units of the cluster buffers, unit 0 is the material's
+ * Must match the units lit.frag's samplers are set to
+ * */
+#define CLUSTER_LIGHTS_UNIT 1
+#define CLUSTER_GRID_UNIT 2
+#define CLUSTER_INDICES_UNIT 3
+
+#define CLUSTER_LIGHT_TEXELS 4
+
+/*
+ * Point or spot light as read by lit.frag, world space
+ * */
+struct ClusterLight {
+  // xyz position, w range
+  vec4 position_range;
+
+  // rgb color, a intensity
+  vec4 color_intensity;
+
+  // xyz spot direction, w 1 for spot lights and 0 for point lights
+  vec4 direction_kind;
+
+  // x cosine of the inner cone angle, y of the outer one
+  vec4 cone;
+};
+
+/*
+ * Inclusive cluster ranges a light was binned to
+ * */
+struct ClusterRange {
+  int min[3];
+  int max[3];
+};
+
+struct ClusterGrid {
+  struct ClusterLight* lights;
+  struct ClusterRange* ranges;
+  unsigned int light_count;
+  unsigned int reserved_lights;
+
+  /*
+   * Offset and count of each cluster's run in `indices`
+   * */
+  uint32_t (*grid)[2];
+
+  uint16_t* indices;
+  unsigned int index_count;
+  unsigned int reserved_indices;
+
+  /*
+   * Slice of a view depth d is log(d) * depth_scale - depth_bias
+   * */
+  float depth_scale;
+  float depth_bias;
+
+  GLuint light_buffer;
+  GLuint grid_buffer;
+  GLuint index_buffer;
+
+  GLuint light_texture;
+  GLuint grid_texture;
+  GLuint index_texture;
+};
+
+GLuint _cluster_texture(GLuint buffer, GLenum format) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  return texture;
+}
+
+void cluster_grid_init(struct ClusterGrid* grid) {
+  grid->lights = NULL;
+  grid->ranges = NULL;
+  grid->light_count = 0;
+  grid->reserved_lights = 0;
+
+  grid->grid = calloc(CLUSTER_COUNT, sizeof(*grid->grid));
+
+  grid->indices = NULL;
+  grid->index_count = 0;
+  grid->reserved_indices = 0;
+
+  grid->depth_scale = 0.0f;
+  grid->depth_bias = 0.0f;
+
+  glGenBuffers(1, &grid->light_buffer);
+  glGenBuffers(1, &grid->grid_buffer);
+  glGenBuffers(1, &grid->index_buffer);
+
+  grid->light_texture = _cluster_texture(grid->light_buffer, GL_RGBA32F);
+  grid->grid_texture = _cluster_texture(grid->grid_buffer, GL_RG32UI);
+  grid->index_texture = _cluster_texture(grid->index_buffer, GL_R16UI);
+}
+
+void cluster_grid_free(struct ClusterGrid* grid) {
+  glDeleteTextures(1, &grid->light_texture);
+  glDeleteTextures(1, &grid->grid_texture);
+  glDeleteTextures(1, &grid->index_texture);
+
+  glDeleteBuffers(1, &grid->light_buffer);
+  glDeleteBuffers(1, &grid->grid_buffer);
+  glDeleteBuffers(1, &grid->index_buffer);
+
+  free(grid->lights);
+  free(grid->ranges);
+  free(grid->grid);
+  free(grid->indices);
+
+  grid->lights = NULL;
+  grid->ranges = NULL;
+  grid->grid = NULL;
+  grid->indices = NULL;
+}
+
+void cluster_grid_clear(struct ClusterGrid* grid) {
+  grid->light_count = 0;
+}
+
+/*
+ * Adds a light for the next cluster_grid_build, ignored past
+ * CLUSTER_MAX_LIGHTS
+ * */
+void cluster_grid_add_light(
+  struct ClusterGrid* grid,
+  struct ComponentLight* light,
+  vec3 position
+) {
+  if (grid->light_count >= CLUSTER_MAX_LIGHTS) return;
+
+  if (grid->light_count >= grid->reserved_lights) {
+    grid->reserved_lights =
+      grid->reserved_lights == 0 ? 64 : grid->reserved_lights * 2;
+
+    grid->lights = realloc(grid->lights,
+      grid->reserved_lights * sizeof(struct ClusterLight));
+    grid->ranges = realloc(grid->ranges,
+      grid->reserved_lights * sizeof(struct ClusterRange));
+  }
+
+  struct ClusterLight* out = &grid->lights[grid->light_count++];
+
+  glm_vec4(position, 0.0f, out->position_range);
+  glm_vec4(light->color, light->intensity, out->color_intensity);
+  glm_vec4_zero(out->direction_kind);
+  glm_vec4_zero(out->cone);
+
+  if (light->light_kind == LK_SPOT) {
+    struct SpotLightData* spot = &light->light_data.spot_light;
+
+    out->position_range[3] = spot->range;
+
+    glm_vec3_normalize_to(spot->direction, out->direction_kind);
+    out->direction_kind[3] = 1.0f;
+
+    out->cone[0] = spot->inner_cutoff;
+    out->cone[1] = spot->outer_cutoff;
+  } else {
+    out->position_range[3] = light->light_data.point_light.range;
+  }
+}
+
+/*
+ * Bounding sphere of a light's area of effect, world space
+ * Spot lights use the smaller of the sphere around their apex and the one
+ * centered halfway along their axis
+ * */
+void _cluster_light_sphere(struct ClusterLight* light, vec4 out_sphere) {
+  float range = light->position_range[3];
+
+  glm_vec4_copy(light->position_range, out_sphere);
+
+  if (light->direction_kind[3] == 0.0f) return;
+
+  float cos_outer = light->cone[1];
+  float radius = range * fmaxf(0.5f, sqrtf(fmaxf(1.25f - cos_outer, 0.0f)));
+  if (radius >= range) return;
+
+  glm_vec3_muladds(light->direction_kind, range * 0.5f, out_sphere);
+  out_sphere[3] = radius;
+}
+
+int _cluster_slice(struct ClusterGrid* grid, float depth) {
+  int slice = (int)floorf(logf(depth) * grid->depth_scale - grid->depth_bias);
+  return glm_clamp(slice, 0, CLUSTER_Z - 1);
+}
+
+int _cluster_tile(float ndc, int tiles) {
+  int tile = (int)floorf((ndc * 0.5f + 0.5f) * tiles);
+  return glm_clamp(tile, 0, tiles - 1);
+}
+
+/*
+ * Finds the clusters a light's sphere may touch: depth slices from the
+ * sphere's depth span, tiles from the screen rectangle of its view space
+ * bounding box
+ * Returns GL_FALSE when the sphere is outside the depth range
+ * */
+GLboolean _cluster_light_range(
+  struct ClusterGrid* grid,
+  vec4 sphere,
+  mat4 view,
+  mat4 projection,
+  float near,
+  float far,
+  struct ClusterRange* out_range
+) {
+  vec3 center;
+  glm_mat4_mulv3(view, sphere, 1.0f, center);
+  float radius = sphere[3];
+
+  float depth = -center[2];
+  float depth_min = depth - radius;
+  float depth_max = depth + radius;
+  if (depth_max < near || depth_min > far) return GL_FALSE;
+
+  out_range->min[2] = _cluster_slice(grid, fmaxf(depth_min, near));
+  out_range->max[2] = _cluster_slice(grid, fminf(depth_max, far));
+
+  out_range->min[0] = 0;
+  out_range->max[0] = CLUSTER_X - 1;
+  out_range->min[1] = 0;
+  out_range->max[1] = CLUSTER_Y - 1;
+
+  // boxes crossing the near plane cover the whole screen
+  if (depth_min <= near) return GL_TRUE;
+
+  vec2 ndc_min = {1.0f, 1.0f};
+  vec2 ndc_max = {-1.0f, -1.0f};
+
+  for (int corner = 0; corner < 8; corner++) {
+    vec4 point = {
+      center[0] + (corner & 1 ? radius : -radius),
+      center[1] + (corner & 2 ? radius : -radius),
+      center[2] + (corner & 4 ? radius : -radius),
+      1.0f,
+    };
+
+    vec4 clip;
+    glm_mat4_mulv(projection, point, clip);
+
+    for (int axis = 0; axis < 2; axis++) {
+      float ndc = clip[axis] / clip[3];
+      ndc_min[axis] = fminf(ndc_min[axis], ndc);
+      ndc_max[axis] = fmaxf(ndc_max[axis], ndc);
+    }
+  }
+
+  if (ndc_max[0] < -1.0f || ndc_min[0] > 1.0f ||
+      ndc_max[1] < -1.0f || ndc_min[1] > 1.0f)
+    return GL_FALSE;
+
+  out_range->min[0] = _cluster_tile(ndc_min[0], CLUSTER_X);
+  out_range->max[0] = _cluster_tile(ndc_max[0], CLUSTER_X);
+  out_range->min[1] = _cluster_tile(ndc_min[1], CLUSTER_Y);
+  out_range->max[1] = _cluster_tile(ndc_max[1], CLUSTER_Y);
+
+  return GL_TRUE;
+}
+
+unsigned int _cluster_index(int x, int y, int z) {
+  return (z * CLUSTER_Y + y) * CLUSTER_X + x;
+}
+
+/*
+ * Bins the lights added since the last cluster_grid_clear into the
+ * clusters of the given camera
+ * CPU only, the result is sent to GL by cluster_grid_upload
+ * */
+void cluster_grid_build(
+  struct ClusterGrid* grid,
+  mat4 view,
+  mat4 projection,
+  float near,
+  float far
+) {
+  float log_ratio = logf(far / near);
+  grid->depth_scale = CLUSTER_Z / log_ratio;
+  grid->depth_bias = CLUSTER_Z * logf(near) / log_ratio;
+
+  for (unsigned int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+    grid->grid[cluster][0] = 0;
+    grid->grid[cluster][1] = 0;
+  }
+
+  // count the lights of every cluster
+  for (unsigned int i = 0; i < grid->light_count; i++) {
+    struct ClusterRange* range = &grid->ranges[i];
+
+    vec4 sphere;
+    _cluster_light_sphere(&grid->lights[i], sphere);
+
+    if (!_cluster_light_range(grid, sphere, view, projection, near, far,
+        range)) {
+      range->min[2] = 1;
+      range->max[2] = 0;
+      continue;
+    }
+
+    for (int z = range->min[2]; z <= range->max[2]; z++)
+      for (int y = range->min[1]; y <= range->max[1]; y++)
+        for (int x = range->min[0]; x <= range->max[0]; x++)
+          grid->grid[_cluster_index(x, y, z)][1]++;
+  }
+
+  unsigned int offset = 0;
+  for (unsigned int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+    grid->grid[cluster][0] = offset;
+    offset += grid->grid[cluster][1];
+    grid->grid[cluster][1] = 0;
+  }
+
+  grid->index_count = offset;
+  if (grid->index_count > grid->reserved_indices) {
+    grid->reserved_indices = grid->index_count;
+    grid->indices = realloc(grid->indices,
+      grid->reserved_indices * sizeof(uint16_t));
+  }
+
+  // fill the runs, counts are rebuilt as the runs grow
+  for (unsigned int i = 0; i < grid->light_count; i++) {
+    struct ClusterRange* range = &grid->ranges[i];
+
+    for (int z = range->min[2]; z <= range->max[2]; z++)
+      for (int y = range->min[1]; y <= range->max[1]; y++)
+        for (int x = range->min[0]; x <= range->max[0]; x++) {
+          uint32_t* cluster = grid->grid[_cluster_index(x, y, z)];
+          grid->indices[cluster[0] + cluster[1]++] = (uint16_t)i;
+        }
+  }
+}
+
+/*
+ * Streams the last build into the cluster buffers, buffers are never
+ * left empty so every texture stays complete
+ * */
+void cluster_grid_upload(struct ClusterGrid* grid) {
+  static const struct ClusterLight NO_LIGHT = {0};
+  static const uint16_t NO_INDEX = 0;
+
+  glBindBuffer(GL_TEXTURE_BUFFER, grid->light_buffer);
+  if (grid->light_count > 0) {
+    glBufferData(GL_TEXTURE_BUFFER,
+      grid->light_count * sizeof(struct ClusterLight), grid->lights,
+      GL_STREAM_DRAW);
+  } else {
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(NO_LIGHT), &NO_LIGHT,
+      GL_STREAM_DRAW);
+  }
+
+  glBindBuffer(GL_TEXTURE_BUFFER, grid->grid_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * sizeof(*grid->grid),
+    grid->grid, GL_STREAM_DRAW);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, grid->index_buffer);
+  if (grid->index_count > 0) {
+    glBufferData(GL_TEXTURE_BUFFER, grid->index_count * sizeof(uint16_t),
+      grid->indices, GL_STREAM_DRAW);
+  } else {
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(NO_INDEX), &NO_INDEX,
+      GL_STREAM_DRAW);
+  }
+
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+#endif
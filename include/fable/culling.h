@@ -0,0 +1,86 @@
+#ifndef FABLE_CULLING_H
+#define FABLE_CULLING_H
+
+#include <stdint.h>
+
+#include <cglm/cglm.h>
+
+#include "fable/fable.h"
+
+/*
+ * Boxes tested together, the inner loops run over a batch so the compiler
+ * can keep one plane in registers and vectorize across boxes
+ * */
+#define CULL_BATCH_SIZE 8
+
+struct Frustum {
+  vec4 planes[6];
+};
+
+/*
+ * Extracts the world space planes of the volume `view_projection` maps to
+ * clip space
+ * */
+void frustum_init(struct Frustum* frustum, mat4 view_projection) {
+  glm_frustum_planes(view_projection, frustum->planes);
+}
+
+/*
+ * Writes 1 to `out_visible[i]` when the world bounds of `mesh_filters[i]`
+ * are at least partly inside the frustum, 0 otherwise
+ *
+ * Same test as glm_aabb_frustum, in center/extent form: a box is outside
+ * a plane when its center is further behind it than the box's extent
+ * projected on the plane's normal. Boxes are gathered a batch at a time
+ * into one array per coordinate so each plane is tested against a whole
+ * batch at once
+ * */
+void frustum_cull_mesh_filters(
+  struct Frustum* frustum,
+  struct ComponentMeshFilter* mesh_filters,
+  unsigned int count,
+  uint8_t* out_visible
+) {
+  for (unsigned int first = 0; first < count; first += CULL_BATCH_SIZE) {
+    unsigned int batch = count - first < CULL_BATCH_SIZE
+      ? count - first
+      : CULL_BATCH_SIZE;
+
+    float center[3][CULL_BATCH_SIZE];
+    float extent[3][CULL_BATCH_SIZE];
+    uint8_t visible[CULL_BATCH_SIZE];
+
+    for (unsigned int i = 0; i < CULL_BATCH_SIZE; i++) {
+      // padding lanes repeat the batch's first box, their results are
+      // never written back
+      vec3* bounds = mesh_filters[first + (i < batch ? i : 0)].world_bounds;
+
+      for (int axis = 0; axis < 3; axis++) {
+        center[axis][i] = (bounds[0][axis] + bounds[1][axis]) * 0.5f;
+        extent[axis][i] = (bounds[1][axis] - bounds[0][axis]) * 0.5f;
+      }
+
+      visible[i] = 1;
+    }
+
+    for (int plane = 0; plane < 6; plane++) {
+      float* p = frustum->planes[plane];
+      float abs_x = fabsf(p[0]), abs_y = fabsf(p[1]), abs_z = fabsf(p[2]);
+
+      for (unsigned int i = 0; i < CULL_BATCH_SIZE; i++) {
+        float distance = p[0] * center[0][i] + p[1] * center[1][i] +
+          p[2] * center[2][i] + p[3];
+        float radius = abs_x * extent[0][i] + abs_y * extent[1][i] +
+          abs_z * extent[2][i];
+
+        visible[i] &= distance + radius >= 0.0f;
+      }
+    }
+
+    for (unsigned int i = 0; i < batch; i++) {
+      out_visible[first + i] = visible[i];
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef FABLE_DEBUG_DRAW_H
+#define FABLE_DEBUG_DRAW_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "fable/gl_state.h"
+
+/*
+ * Attribute locations of debug.vert
+ * */
+#define DEBUG_POSITION_LOCATION 0
+#define DEBUG_COLOR_LOCATION 1
+
+#define DEBUG_POINT_SIZE 6.0f
+#define DEBUG_SPHERE_SEGMENTS 24
+
+struct DebugVertex {
+  vec3 position;
+  uint8_t color[4];
+};
+
+struct DebugVertexArray {
+  struct DebugVertex* vertices;
+  unsigned int count;
+  unsigned int reserved;
+};
+
+/*
+ * Immediate-mode debug renderer
+ *
+ * Lines and points are appended to CPU arrays over the frame, then
+ * uploaded together and drawn with one GL_LINES and one GL_POINTS draw by
+ * debug_draw_flush
+ * Appending never touches GL, so it may happen off the main thread as
+ * long as access is guarded like any other shared frame data. Flushing
+ * must happen on the main thread
+ * */
+struct DebugDraw {
+  GLuint vao;
+  GLuint vbo;
+
+  struct DebugVertexArray lines;
+  struct DebugVertexArray points;
+};
+
+void debug_draw_init(struct DebugDraw* draw) {
+  glGenVertexArrays(1, &draw->vao);
+  glGenBuffers(1, &draw->vbo);
+
+  GLint bound_vertex_array, bound_array_buffer;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &bound_vertex_array);
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &bound_array_buffer);
+
+  glBindVertexArray(draw->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, draw->vbo);
+
+  glVertexAttribPointer(DEBUG_POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE,
+    sizeof(struct DebugVertex),
+    (void*)offsetof(struct DebugVertex, position));
+  glEnableVertexAttribArray(DEBUG_POSITION_LOCATION);
+
+  glVertexAttribPointer(DEBUG_COLOR_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+    sizeof(struct DebugVertex),
+    (void*)offsetof(struct DebugVertex, color));
+  glEnableVertexAttribArray(DEBUG_COLOR_LOCATION);
+
+  glBindVertexArray(bound_vertex_array);
+  glBindBuffer(GL_ARRAY_BUFFER, bound_array_buffer);
+
+  draw->lines = (struct DebugVertexArray){0};
+  draw->points = (struct DebugVertexArray){0};
+}
+
+void debug_draw_free(struct GLState* gl_state, struct DebugDraw* draw) {
+  gl_state_delete_vertex_array(gl_state, draw->vao);
+  glDeleteBuffers(1, &draw->vbo);
+
+  free(draw->lines.vertices);
+  free(draw->points.vertices);
+
+  draw->lines = (struct DebugVertexArray){0};
+  draw->points = (struct DebugVertexArray){0};
+}
+
+void debug_draw_clear(struct DebugDraw* draw) {
+  draw->lines.count = 0;
+  draw->points.count = 0;
+}
+
+void _debug_vertex_push(
+  struct DebugVertexArray* array,
+  vec3 position,
+  vec3 color
+) {
+  if (array->count >= array->reserved) {
+    array->reserved = array->reserved == 0 ? 256 : array->reserved * 2;
+    array->vertices = realloc(array->vertices,
+      array->reserved * sizeof(struct DebugVertex));
+  }
+
+  struct DebugVertex* vertex = &array->vertices[array->count++];
+  glm_vec3_copy(position, vertex->position);
+
+  for (int i = 0; i < 3; i++)
+    vertex->color[i] = (uint8_t)(glm_clamp_zo(color[i]) * 255.0f + 0.5f);
+  vertex->color[3] = 255;
+}
+
+void debug_draw_line(struct DebugDraw* draw, vec3 from, vec3 to, vec3 color) {
+  _debug_vertex_push(&draw->lines, from, color);
+  _debug_vertex_push(&draw->lines, to, color);
+}
+
+void debug_draw_point(struct DebugDraw* draw, vec3 position, vec3 color) {
+  _debug_vertex_push(&draw->points, position, color);
+}
+
+/*
+ * Outlines a box from its 8 corners, corner i being at the positive end
+ * of x if bit 0 of i is set, of y for bit 1 and of z for bit 2
+ * */
+void debug_draw_box(struct DebugDraw* draw, vec3 corners[8], vec3 color) {
+  for (int corner = 0; corner < 8; corner++) {
+    for (int bit = 1; bit < 8; bit <<= 1) {
+      if (corner & bit) continue;
+      debug_draw_line(draw, corners[corner], corners[corner | bit], color);
+    }
+  }
+}
+
+void debug_draw_aabb(struct DebugDraw* draw, vec3 bounds[2], vec3 color) {
+  vec3 corners[8];
+  for (int corner = 0; corner < 8; corner++) {
+    for (int axis = 0; axis < 3; axis++)
+      corners[corner][axis] = bounds[(corner >> axis) & 1][axis];
+  }
+
+  debug_draw_box(draw, corners, color);
+}
+
+/*
+ * Outlines a sphere with one circle in each axis plane
+ * */
+void debug_draw_sphere(
+  struct DebugDraw* draw,
+  vec3 center,
+  float radius,
+  vec3 color
+) {
+  for (int axis = 0; axis < 3; axis++) {
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+
+    vec3 previous;
+    glm_vec3_copy(center, previous);
+    previous[u] += radius;
+
+    for (int segment = 1; segment <= DEBUG_SPHERE_SEGMENTS; segment++) {
+      float angle = 2.0f * GLM_PIf * segment / DEBUG_SPHERE_SEGMENTS;
+
+      vec3 next;
+      glm_vec3_copy(center, next);
+      next[u] += cosf(angle) * radius;
+      next[v] += sinf(angle) * radius;
+
+      debug_draw_line(draw, previous, next, color);
+      glm_vec3_copy(next, previous);
+    }
+  }
+}
+
+/*
+ * Draws everything appended since the last flush with `program`, then
+ * clears the arrays
+ * Debug geometry is depth tested but does not write depth, depth writes
+ * are enabled again before returning
+ * */
+void debug_draw_flush(
+  struct DebugDraw* draw,
+  struct GLState* gl_state,
+  GLuint program
+) {
+  unsigned int line_count = draw->lines.count;
+  unsigned int point_count = draw->points.count;
+  if (line_count + point_count == 0) return;
+
+  size_t line_size = line_count * sizeof(struct DebugVertex);
+  size_t point_size = point_count * sizeof(struct DebugVertex);
+
+  // orphan last frame's storage, lines first and points after them
+  glBindBuffer(GL_ARRAY_BUFFER, draw->vbo);
+  glBufferData(GL_ARRAY_BUFFER, line_size + point_size, NULL,
+    GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, line_size, draw->lines.vertices);
+  glBufferSubData(GL_ARRAY_BUFFER, line_size, point_size,
+    draw->points.vertices);
+
+  gl_state_use_program(gl_state, program);
+  gl_state_bind_vertex_array(gl_state, draw->vao);
+
+  gl_state_set_enabled(gl_state, GSC_BLEND, GL_FALSE);
+  gl_state_depth_mask(gl_state, GL_FALSE);
+  gl_state_depth_func(gl_state, GL_LEQUAL);
+  gl_state_polygon_mode(gl_state, GL_FILL);
+
+  if (line_count > 0)
+    glDrawArrays(GL_LINES, 0, line_count);
+
+  if (point_count > 0) {
+    glPointSize(DEBUG_POINT_SIZE);
+    glDrawArrays(GL_POINTS, line_count, point_count);
+  }
+
+  gl_state_depth_mask(gl_state, GL_TRUE);
+
+  debug_draw_clear(draw);
+}
+
+#endif
@@ -0,0 +1,1649 @@
+#ifndef FABLE_ECS_H
+#define FABLE_ECS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fable/fable.h"
+
+/*
+ * Number of entities stored in a single chunk
+ * Every column of a chunk holds exactly this many components, so the
+ * transforms of a chunk are CHUNK_CAPACITY tightly packed
+ * ComponentTransform structs
+ * */
+#define CHUNK_CAPACITY 128
+
+/*
+ * Columns inside a chunk are aligned to this many bytes
+ * */
+#define CHUNK_COLUMN_ALIGN 16
+
+#define CK_BIT(kind) (1u << (kind))
+
+/*
+ * Entities are referred to by generational 32-bit handles:
+ *  - the low ENTITY_INDEX_BITS select a slot in the world's entity records
+ *  - the remaining bits hold the slot's generation when the handle was made
+ * Each time a slot is recycled its generation is bumped, so handles to a
+ * destroyed entity are detected as stale instead of aliasing the new one
+ * Generations start at 1, which keeps ENTITY_NULL (0) invalid forever
+ * The largest generation is never issued to a live entity, it marks
+ * placeholder handles returned by command_buffer_spawn
+ * EntityId and ENTITY_NULL are declared in fable/fable.h
+ * */
+#define ENTITY_INDEX_BITS 20
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_GENERATION_MAX (0xFFFFFFFFu >> ENTITY_INDEX_BITS)
+#define ENTITY_GENERATION_PENDING ENTITY_GENERATION_MAX
+#define MAX_ENTITIES (1u << ENTITY_INDEX_BITS)
+
+/*
+ * Change ticks
+ *
+ * The world keeps a counter that systems advance when they start running
+ * (see world_advance_tick). Every component stores the tick of its last
+ * write, so a system that remembers the tick of its previous run can
+ * tell which components changed since then without comparing values
+ * Tick 0 means "never changed", the world starts counting at 1
+ * */
+#define TICK_NEVER 0u
+
+#define ENTITY_ID(index, generation) \
+  (((uint32_t)(generation) << ENTITY_INDEX_BITS) | (uint32_t)(index))
+#define ENTITY_INDEX(id) ((id) & ENTITY_INDEX_MASK)
+#define ENTITY_GENERATION(id) ((id) >> ENTITY_INDEX_BITS)
+
+static const size_t COMPONENT_SIZES[CK_COUNT] = {
+  [CK_TRANSFORM] = sizeof(struct ComponentTransform),
+  [CK_MESH_FILTER] = sizeof(struct ComponentMeshFilter),
+  [CK_MESH_RENDERER] = sizeof(struct ComponentMeshRenderer),
+  [CK_MATERIAL] = sizeof(struct Material),
+  [CK_LIGHT] = sizeof(struct ComponentLight),
+  [CK_CAMERA] = sizeof(struct ComponentCamera),
+  [CK_RIGIDBODY] = sizeof(struct ComponentRigidbody),
+  [CK_BOX_COLLIDER] = sizeof(struct ComponentBoxCollider),
+};
+
+/*
+ * Component kinds stored in sparse-set pools instead of archetype tables
+ *
+ * Table storage is best for components that are iterated in bulk every
+ * frame, sparse storage for components that are few, looked up one at a
+ * time or frequently attached and detached. Adding or removing a sparse
+ * component never moves the entity between archetypes
+ * */
+#define SPARSE_COMPONENTS \
+  (CK_BIT(CK_MATERIAL) | CK_BIT(CK_LIGHT) | CK_BIT(CK_CAMERA))
+
+#define IS_SPARSE_COMPONENT(kind) ((SPARSE_COMPONENTS & CK_BIT(kind)) != 0)
+
+/*
+ * Marks an entity index without a component in ComponentPool.sparse
+ * */
+#define POOL_EMPTY 0xFFFFFFFFu
+
+/*
+ * Sparse set holding every component of one kind
+ *  - sparse maps an entity index to the component's position in the
+ *    dense arrays, or POOL_EMPTY
+ *  - entities/enabled/data are dense and kept packed by swap-removal,
+ *    so iterating data[0 .. count) never hits a hole
+ * */
+struct ComponentPool {
+  size_t component_size;
+
+  unsigned int* sparse;
+  unsigned int sparse_capacity;
+
+  EntityId* entities;
+  GLboolean* enabled;
+  uint32_t* changed_ticks;
+  unsigned char* data;
+  unsigned int count;
+  unsigned int reserved;
+};
+
+/*
+ * A chunk stores up to CHUNK_CAPACITY entities of one archetype
+ * Component data is laid out as one column per component kind (SoA),
+ * the column for archetype->kinds[i] lives at columns[i] and the ticks
+ * of its rows at changed_ticks[i]
+ * The chunk header and all of its columns share a single allocation
+ * */
+struct Chunk {
+  unsigned int count;
+
+  /*
+   * Entity stored in each row, used to patch entity records when
+   * rows are moved around by swap-removal
+   * */
+  EntityId entities[CHUNK_CAPACITY];
+
+  /*
+   * Bitmask of enabled components per row (see CK_BIT)
+   * */
+  uint32_t enabled[CHUNK_CAPACITY];
+
+  void* columns[CK_COUNT];
+
+  /*
+   * Tick of the last write to each row of a column, set when a component
+   * is added and through world_mark_changed / chunk_mark_changed
+   * */
+  uint32_t* changed_ticks[CK_COUNT];
+
+  /*
+   * Newest tick of each column, lets change queries skip a whole chunk
+   * with a single compare
+   * Never lowered when rows are removed, so it may be newer than every
+   * remaining row but is never older
+   * */
+  uint32_t column_ticks[CK_COUNT];
+};
+
+/*
+ * An archetype groups every entity with the exact same set of components
+ * Chunks are kept dense: every chunk but the last one is full
+ * */
+struct Archetype {
+  uint32_t mask;
+
+  /*
+   * Component kinds of this archetype in ascending order
+   * */
+  enum ComponentKind kinds[CK_COUNT];
+  unsigned int kind_count;
+
+  /*
+   * Direct lookup table from component kind to column index,
+   * -1 for kinds the archetype does not have
+   * */
+  int column_of[CK_COUNT];
+
+  struct Chunk** chunks;
+  unsigned int chunk_count;
+  unsigned int reserved_chunks;
+
+  /*
+   * Chunks are not freed when they empty out, chunks[chunk_count] up to
+   * chunks[allocated_chunks - 1] are spare and reused before allocating
+   * */
+  unsigned int allocated_chunks;
+};
+
+/*
+ * Slot of the entity table, describes where an entity lives inside the
+ * archetype store
+ * Free slots are chained through next_free
+ * */
+struct EntityRecord {
+  char* name;
+
+  uint32_t generation;
+  GLboolean is_alive;
+  unsigned int next_free;
+
+  /*
+   * Components attached to this entity (see CK_BIT)
+   * Mirrors the archetype mask so "has component" checks never
+   * leave the record
+   * */
+  uint32_t mask;
+
+  unsigned int archetype;
+  unsigned int chunk;
+  unsigned int row;
+};
+
+struct World {
+  /*
+   * Archetypes are referenced by index since the array is reallocated
+   * as new archetypes are discovered
+   * Index 0 is always the empty archetype
+   * */
+  struct Archetype* archetypes;
+  unsigned int archetype_count;
+  unsigned int reserved_archetypes;
+
+  /*
+   * Entity slots, indexed by ENTITY_INDEX
+   * entity_count is the number of slots ever handed out, alive or not
+   * */
+  struct EntityRecord* entities;
+  unsigned int entity_count;
+  unsigned int reserved_entities;
+
+  unsigned int alive_count;
+
+  /*
+   * Head of the list of recycled slots, MAX_ENTITIES if empty
+   * */
+  unsigned int free_head;
+
+  /*
+   * Storage for SPARSE_COMPONENTS, indexed by kind
+   * Pools of table kinds stay empty
+   * */
+  struct ComponentPool pools[CK_COUNT];
+
+  /*
+   * Tick stamped on component writes made outside of a system run
+   * */
+  uint32_t change_tick;
+};
+
+void pool_init(struct ComponentPool* pool, size_t component_size) {
+  pool->component_size = component_size;
+
+  pool->sparse = NULL;
+  pool->sparse_capacity = 0;
+
+  pool->entities = NULL;
+  pool->enabled = NULL;
+  pool->changed_ticks = NULL;
+  pool->data = NULL;
+  pool->count = 0;
+  pool->reserved = 0;
+}
+
+void pool_free(struct ComponentPool* pool) {
+  free(pool->sparse);
+  free(pool->entities);
+  free(pool->enabled);
+  free(pool->changed_ticks);
+  free(pool->data);
+
+  pool_init(pool, pool->component_size);
+}
+
+/*
+ * Returns the entity's component, or NULL if it has none
+ * The caller is responsible for checking the handle's generation
+ * */
+void* pool_get(struct ComponentPool* pool, EntityId entity) {
+  unsigned int index = ENTITY_INDEX(entity);
+  if (index >= pool->sparse_capacity || pool->sparse[index] == POOL_EMPTY)
+    return NULL;
+
+  return pool->data + pool->sparse[index] * pool->component_size;
+}
+
+/*
+ * Stores a copy of `data` for the entity, overwriting its existing
+ * component if it already has one, and stamps it with `tick`
+ * */
+void* pool_add(
+  struct ComponentPool* pool,
+  EntityId entity,
+  const void* data,
+  uint32_t tick
+) {
+  unsigned int index = ENTITY_INDEX(entity);
+
+  if (index >= pool->sparse_capacity) {
+    unsigned int capacity = pool->sparse_capacity == 0
+      ? 16
+      : pool->sparse_capacity;
+    while (capacity <= index)
+      capacity *= 2;
+
+    pool->sparse = realloc(pool->sparse, capacity * sizeof(unsigned int));
+    for (unsigned int i = pool->sparse_capacity; i < capacity; i++)
+      pool->sparse[i] = POOL_EMPTY;
+
+    pool->sparse_capacity = capacity;
+  }
+
+  if (pool->sparse[index] == POOL_EMPTY) {
+    if (pool->count >= pool->reserved) {
+      pool->reserved = pool->reserved == 0 ? 4 : pool->reserved * 2;
+
+      pool->entities =
+        realloc(pool->entities, pool->reserved * sizeof(EntityId));
+      pool->enabled =
+        realloc(pool->enabled, pool->reserved * sizeof(GLboolean));
+      pool->changed_ticks =
+        realloc(pool->changed_ticks, pool->reserved * sizeof(uint32_t));
+      pool->data =
+        realloc(pool->data, pool->reserved * pool->component_size);
+    }
+
+    pool->sparse[index] = pool->count;
+    pool->entities[pool->count] = entity;
+    pool->count++;
+  }
+
+  unsigned int dense = pool->sparse[index];
+  void* component = pool->data + dense * pool->component_size;
+
+  pool->enabled[dense] = GL_TRUE;
+  pool->changed_ticks[dense] = tick;
+  memcpy(component, data, pool->component_size);
+
+  return component;
+}
+
+/*
+ * Removes the entity's component by moving the last dense element into
+ * its place
+ * */
+void pool_remove(struct ComponentPool* pool, EntityId entity) {
+  unsigned int index = ENTITY_INDEX(entity);
+  if (index >= pool->sparse_capacity || pool->sparse[index] == POOL_EMPTY)
+    return;
+
+  unsigned int dense = pool->sparse[index];
+  unsigned int last = pool->count - 1;
+
+  if (dense != last) {
+    EntityId moved = pool->entities[last];
+
+    pool->entities[dense] = moved;
+    pool->enabled[dense] = pool->enabled[last];
+    pool->changed_ticks[dense] = pool->changed_ticks[last];
+    memcpy(
+      pool->data + dense * pool->component_size,
+      pool->data + last * pool->component_size,
+      pool->component_size
+    );
+
+    pool->sparse[ENTITY_INDEX(moved)] = dense;
+  }
+
+  pool->sparse[index] = POOL_EMPTY;
+  pool->count--;
+}
+
+int archetype_column(struct Archetype* archetype, enum ComponentKind kind) {
+  return archetype->column_of[kind];
+}
+
+/*
+ * Returns the column of `kind` inside `chunk`, or NULL if the
+ * archetype does not have that component
+ * The returned array holds chunk->count valid components
+ * */
+void* chunk_column(
+  struct Archetype* archetype,
+  struct Chunk* chunk,
+  enum ComponentKind kind
+) {
+  int column = archetype_column(archetype, kind);
+  if (column < 0)
+    return NULL;
+
+  return chunk->columns[column];
+}
+
+/*
+ * Stamps a row of a chunk as written at `tick`
+ * Systems writing straight into chunk columns call this for every row
+ * they modify, usually with the tick returned by world_advance_tick
+ * */
+void chunk_mark_changed(
+  struct Archetype* archetype,
+  struct Chunk* chunk,
+  enum ComponentKind kind,
+  unsigned int row,
+  uint32_t tick
+) {
+  int column = archetype_column(archetype, kind);
+  if (column < 0)
+    return;
+
+  chunk->changed_ticks[column][row] = tick;
+  if (tick > chunk->column_ticks[column])
+    chunk->column_ticks[column] = tick;
+}
+
+/*
+ * Whether a row of `kind` was written after `since`
+ * */
+GLboolean chunk_changed_since(
+  struct Archetype* archetype,
+  struct Chunk* chunk,
+  enum ComponentKind kind,
+  unsigned int row,
+  uint32_t since
+) {
+  int column = archetype_column(archetype, kind);
+  if (column < 0)
+    return GL_FALSE;
+
+  return chunk->changed_ticks[column][row] > since ? GL_TRUE : GL_FALSE;
+}
+
+struct Chunk* chunk_create(struct Archetype* archetype) {
+  size_t header_size =
+    (sizeof(struct Chunk) + CHUNK_COLUMN_ALIGN - 1) &
+    ~(size_t)(CHUNK_COLUMN_ALIGN - 1);
+
+  size_t ticks_size = CHUNK_CAPACITY * sizeof(uint32_t);
+
+  size_t total_size = header_size;
+  for (unsigned int i = 0; i < archetype->kind_count; i++) {
+    size_t column_size =
+      COMPONENT_SIZES[archetype->kinds[i]] * CHUNK_CAPACITY;
+    total_size += (column_size + CHUNK_COLUMN_ALIGN - 1) &
+      ~(size_t)(CHUNK_COLUMN_ALIGN - 1);
+    total_size += ticks_size;
+  }
+
+  struct Chunk* chunk = malloc(total_size);
+  chunk->count = 0;
+
+  unsigned char* cursor = (unsigned char*)chunk + header_size;
+  for (unsigned int i = 0; i < archetype->kind_count; i++) {
+    size_t column_size =
+      COMPONENT_SIZES[archetype->kinds[i]] * CHUNK_CAPACITY;
+
+    chunk->columns[i] = cursor;
+    cursor += (column_size + CHUNK_COLUMN_ALIGN - 1) &
+      ~(size_t)(CHUNK_COLUMN_ALIGN - 1);
+  }
+
+  // tick arrays after the columns, so they do not break column alignment
+  for (unsigned int i = 0; i < archetype->kind_count; i++) {
+    chunk->changed_ticks[i] = (uint32_t*)cursor;
+    chunk->column_ticks[i] = TICK_NEVER;
+    cursor += ticks_size;
+  }
+
+  return chunk;
+}
+
+unsigned int world_archetype(struct World* world, uint32_t mask) {
+  for (unsigned int i = 0; i < world->archetype_count; i++) {
+    if (world->archetypes[i].mask == mask) {
+      return i;
+    }
+  }
+
+  if (world->archetype_count >= world->reserved_archetypes) {
+    world->reserved_archetypes = world->reserved_archetypes == 0
+      ? 8
+      : world->reserved_archetypes * 2;
+    world->archetypes = realloc(
+      world->archetypes,
+      world->reserved_archetypes * sizeof(struct Archetype)
+    );
+  }
+
+  struct Archetype* archetype = &world->archetypes[world->archetype_count];
+  archetype->mask = mask;
+  archetype->kind_count = 0;
+  archetype->chunks = NULL;
+  archetype->chunk_count = 0;
+  archetype->reserved_chunks = 0;
+  archetype->allocated_chunks = 0;
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    if (mask & CK_BIT(kind)) {
+      archetype->column_of[kind] = archetype->kind_count;
+      archetype->kinds[archetype->kind_count++] = kind;
+    } else {
+      archetype->column_of[kind] = -1;
+    }
+  }
+
+  return world->archetype_count++;
+}
+
+/*
+ * Returns the index of the archetype's last chunk, opening a new one
+ * (spare or freshly allocated) if the last chunk is full
+ * */
+unsigned int archetype_open_chunk(struct Archetype* archetype) {
+  if (archetype->chunk_count == 0 ||
+      archetype->chunks[archetype->chunk_count - 1]->count >= CHUNK_CAPACITY) {
+    if (archetype->chunk_count == archetype->allocated_chunks) {
+      if (archetype->allocated_chunks >= archetype->reserved_chunks) {
+        archetype->reserved_chunks = archetype->reserved_chunks == 0
+          ? 4
+          : archetype->reserved_chunks * 2;
+        archetype->chunks = realloc(
+          archetype->chunks,
+          archetype->reserved_chunks * sizeof(struct Chunk*)
+        );
+      }
+
+      archetype->chunks[archetype->allocated_chunks++] =
+        chunk_create(archetype);
+    }
+
+    struct Chunk* fresh = archetype->chunks[archetype->chunk_count++];
+    fresh->count = 0;
+    for (unsigned int i = 0; i < archetype->kind_count; i++)
+      fresh->column_ticks[i] = TICK_NEVER;
+  }
+
+  return archetype->chunk_count - 1;
+}
+
+/*
+ * Appends `entity` to the archetype and returns its chunk and row
+ * The row's component data is left uninitialized
+ * */
+void archetype_push(
+  struct Archetype* archetype,
+  EntityId entity,
+  unsigned int* out_chunk,
+  unsigned int* out_row
+) {
+  unsigned int chunk_index = archetype_open_chunk(archetype);
+  struct Chunk* chunk = archetype->chunks[chunk_index];
+  unsigned int row = chunk->count++;
+
+  chunk->entities[row] = entity;
+  chunk->enabled[row] = 0;
+  for (unsigned int i = 0; i < archetype->kind_count; i++)
+    chunk->changed_ticks[i][row] = TICK_NEVER;
+
+  *out_chunk = chunk_index;
+  *out_row = row;
+}
+
+/*
+ * Removes a row by moving the archetype's last row into it
+ * This keeps every chunk but the last one full
+ * */
+void world_remove_row(
+  struct World* world,
+  unsigned int archetype_index,
+  unsigned int chunk_index,
+  unsigned int row
+) {
+  struct Archetype* archetype = &world->archetypes[archetype_index];
+  struct Chunk* chunk = archetype->chunks[chunk_index];
+
+  unsigned int last_chunk_index = archetype->chunk_count - 1;
+  struct Chunk* last_chunk = archetype->chunks[last_chunk_index];
+  unsigned int last_row = last_chunk->count - 1;
+
+  if (chunk != last_chunk || row != last_row) {
+    for (unsigned int i = 0; i < archetype->kind_count; i++) {
+      size_t size = COMPONENT_SIZES[archetype->kinds[i]];
+
+      memcpy(
+        (unsigned char*)chunk->columns[i] + row * size,
+        (unsigned char*)last_chunk->columns[i] + last_row * size,
+        size
+      );
+
+      uint32_t tick = last_chunk->changed_ticks[i][last_row];
+      chunk->changed_ticks[i][row] = tick;
+      if (tick > chunk->column_ticks[i])
+        chunk->column_ticks[i] = tick;
+    }
+
+    EntityId moved = last_chunk->entities[last_row];
+    chunk->entities[row] = moved;
+    chunk->enabled[row] = last_chunk->enabled[last_row];
+
+    world->entities[ENTITY_INDEX(moved)].chunk = chunk_index;
+    world->entities[ENTITY_INDEX(moved)].row = row;
+  }
+
+  last_chunk->count--;
+
+  // keep the emptied chunk around as a spare
+  if (last_chunk->count == 0)
+    archetype->chunk_count--;
+}
+
+void world_init(struct World* world) {
+  world->archetypes = NULL;
+  world->archetype_count = 0;
+  world->reserved_archetypes = 0;
+
+  world->entities = NULL;
+  world->entity_count = 0;
+  world->reserved_entities = 0;
+
+  world->alive_count = 0;
+  world->free_head = MAX_ENTITIES;
+
+  world->change_tick = 1;
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    pool_init(&world->pools[kind], COMPONENT_SIZES[kind]);
+  }
+
+  // the empty archetype, every entity starts out here
+  world_archetype(world, 0);
+}
+
+void world_free(struct World* world) {
+  for (unsigned int i = 0; i < world->archetype_count; i++) {
+    struct Archetype* archetype = &world->archetypes[i];
+
+    for (unsigned int j = 0; j < archetype->allocated_chunks; j++) {
+      free(archetype->chunks[j]);
+    }
+
+    free(archetype->chunks);
+  }
+
+  free(world->archetypes);
+  free(world->entities);
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    pool_free(&world->pools[kind]);
+  }
+
+  world->archetypes = NULL;
+  world->archetype_count = 0;
+  world->reserved_archetypes = 0;
+
+  world->entities = NULL;
+  world->entity_count = 0;
+  world->reserved_entities = 0;
+
+  world->alive_count = 0;
+  world->free_head = MAX_ENTITIES;
+}
+
+/*
+ * Returns the record of a live entity, or NULL if the handle is
+ * ENTITY_NULL or stale
+ * */
+struct EntityRecord* world_record(struct World* world, EntityId entity) {
+  unsigned int index = ENTITY_INDEX(entity);
+  if (index >= world->entity_count)
+    return NULL;
+
+  struct EntityRecord* record = &world->entities[index];
+  if (!record->is_alive || record->generation != ENTITY_GENERATION(entity))
+    return NULL;
+
+  return record;
+}
+
+GLboolean world_is_alive(struct World* world, EntityId entity) {
+  return world_record(world, entity) != NULL ? GL_TRUE : GL_FALSE;
+}
+
+/*
+ * Takes a free entity slot and marks it alive, without placing the
+ * entity in any archetype
+ * Returns ENTITY_NULL if the world is full
+ * */
+EntityId world_alloc_entity(struct World* world, char* name) {
+  unsigned int index;
+
+  if (world->free_head != MAX_ENTITIES) {
+    index = world->free_head;
+    world->free_head = world->entities[index].next_free;
+  } else {
+    if (world->entity_count >= MAX_ENTITIES) {
+      fprintf(stderr, "Entity limit reached (%u)\n", MAX_ENTITIES);
+      return ENTITY_NULL;
+    }
+
+    if (world->entity_count >= world->reserved_entities) {
+      world->reserved_entities = world->reserved_entities == 0
+        ? 16
+        : world->reserved_entities * 2;
+      world->entities = realloc(
+        world->entities,
+        world->reserved_entities * sizeof(struct EntityRecord)
+      );
+    }
+
+    index = world->entity_count++;
+    world->entities[index].generation = 1;
+  }
+
+  struct EntityRecord* record = &world->entities[index];
+
+  record->name = name;
+  record->is_alive = GL_TRUE;
+  record->next_free = MAX_ENTITIES;
+  record->mask = 0;
+  record->archetype = 0;
+
+  world->alive_count++;
+
+  return ENTITY_ID(index, record->generation);
+}
+
+/*
+ * Creates an entity with no components
+ * Recycles a destroyed slot when one is available, so steady-state
+ * spawning and despawning does not allocate
+ * Returns ENTITY_NULL if the world is full
+ * */
+EntityId world_spawn(struct World* world, char* name) {
+  EntityId entity = world_alloc_entity(world, name);
+  if (entity == ENTITY_NULL)
+    return ENTITY_NULL;
+
+  struct EntityRecord* record = &world->entities[ENTITY_INDEX(entity)];
+  archetype_push(&world->archetypes[0], entity,
+    &record->chunk, &record->row);
+
+  return entity;
+}
+
+/*
+ * Makes sure `count` more entities can be created without growing the
+ * entity table again
+ * */
+void world_reserve_entities(struct World* world, unsigned int count) {
+  unsigned int needed = world->entity_count + count;
+  if (needed > MAX_ENTITIES)
+    needed = MAX_ENTITIES;
+
+  if (needed <= world->reserved_entities)
+    return;
+
+  world->reserved_entities = needed;
+  world->entities = realloc(
+    world->entities,
+    world->reserved_entities * sizeof(struct EntityRecord)
+  );
+}
+
+/*
+ * Spawns `count` entities straight into the archetype of `mask`, without
+ * passing through the empty archetype, and writes their handles to `out`
+ * `mask` must only contain table components. Each component column is
+ * filled by copying templates[kind], doubling the copied range on each
+ * memcpy so a full chunk takes a handful of calls per column
+ * Returns the number of entities spawned, less than `count` only if the
+ * world ran out of entity slots
+ * */
+unsigned int world_spawn_batch(
+  struct World* world,
+  char* name,
+  uint32_t mask,
+  const void* const templates[CK_COUNT],
+  unsigned int count,
+  EntityId* out
+) {
+  if (mask & SPARSE_COMPONENTS) {
+    fprintf(stderr, "Batch spawns cannot hold sparse components\n");
+    return 0;
+  }
+
+  world_reserve_entities(world, count);
+
+  unsigned int archetype_index = world_archetype(world, mask);
+  struct Archetype* archetype = &world->archetypes[archetype_index];
+  uint32_t tick = world->change_tick;
+
+  unsigned int spawned = 0;
+  while (spawned < count) {
+    unsigned int chunk_index = archetype_open_chunk(archetype);
+    struct Chunk* chunk = archetype->chunks[chunk_index];
+
+    unsigned int first = chunk->count;
+    unsigned int span = CHUNK_CAPACITY - first;
+    if (span > count - spawned)
+      span = count - spawned;
+
+    unsigned int allocated = 0;
+    for (; allocated < span; allocated++) {
+      EntityId entity = world_alloc_entity(world, name);
+      if (entity == ENTITY_NULL)
+        break;
+
+      unsigned int row = first + allocated;
+      struct EntityRecord* record = &world->entities[ENTITY_INDEX(entity)];
+      record->mask = mask;
+      record->archetype = archetype_index;
+      record->chunk = chunk_index;
+      record->row = row;
+
+      chunk->entities[row] = entity;
+      chunk->enabled[row] = mask;
+      out[spawned + allocated] = entity;
+    }
+
+    for (unsigned int i = 0; i < archetype->kind_count; i++) {
+      size_t size = COMPONENT_SIZES[archetype->kinds[i]];
+      unsigned char* column = (unsigned char*)chunk->columns[i] + first * size;
+
+      memcpy(column, templates[archetype->kinds[i]], size);
+      for (unsigned int filled = 1; filled < allocated;) {
+        unsigned int copy = filled < allocated - filled
+          ? filled
+          : allocated - filled;
+        memcpy(column + filled * size, column, copy * size);
+        filled += copy;
+      }
+
+      for (unsigned int row = first; row < first + allocated; row++)
+        chunk->changed_ticks[i][row] = tick;
+      if (allocated > 0 && tick > chunk->column_ticks[i])
+        chunk->column_ticks[i] = tick;
+    }
+
+    chunk->count += allocated;
+    spawned += allocated;
+
+    if (allocated < span) {
+      // the chunk was opened for nothing, hand it back as a spare
+      if (chunk->count == 0)
+        archetype->chunk_count--;
+      break;
+    }
+  }
+
+  return spawned;
+}
+
+/*
+ * Destroys an entity and all of its components
+ * Every handle to it becomes stale, the slot is recycled by a later spawn
+ * Despawning a stale handle does nothing
+ * */
+void world_despawn(struct World* world, EntityId entity) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL)
+    return;
+
+  world_remove_row(world, record->archetype, record->chunk, record->row);
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    if (IS_SPARSE_COMPONENT(kind) && (record->mask & CK_BIT(kind)))
+      pool_remove(&world->pools[kind], entity);
+  }
+
+  record->is_alive = GL_FALSE;
+  record->mask = 0;
+  record->generation = record->generation + 1 >= ENTITY_GENERATION_PENDING
+    ? 1
+    : record->generation + 1;
+
+  record->next_free = world->free_head;
+  world->free_head = ENTITY_INDEX(entity);
+
+  world->alive_count--;
+}
+
+/*
+ * Moves the row of an entity into the archetype of `new_mask`, copying
+ * the components both archetypes share
+ * `new_mask` must only contain table components
+ * */
+void world_move_entity(
+  struct World* world,
+  struct EntityRecord* record,
+  EntityId entity,
+  uint32_t new_mask
+) {
+  unsigned int new_index = world_archetype(world, new_mask);
+
+  struct Archetype* old_archetype = &world->archetypes[record->archetype];
+  struct Archetype* new_archetype = &world->archetypes[new_index];
+
+  unsigned int new_chunk_index, new_row;
+  archetype_push(new_archetype, entity, &new_chunk_index, &new_row);
+
+  struct Chunk* old_chunk = old_archetype->chunks[record->chunk];
+  struct Chunk* new_chunk = new_archetype->chunks[new_chunk_index];
+
+  for (unsigned int i = 0; i < old_archetype->kind_count; i++) {
+    enum ComponentKind kind = old_archetype->kinds[i];
+    if (!(new_mask & CK_BIT(kind)))
+      continue;
+
+    size_t size = COMPONENT_SIZES[kind];
+
+    memcpy(
+      (unsigned char*)chunk_column(new_archetype, new_chunk, kind)
+        + new_row * size,
+      (unsigned char*)old_chunk->columns[i] + record->row * size,
+      size
+    );
+
+    chunk_mark_changed(new_archetype, new_chunk, kind, new_row,
+      old_chunk->changed_ticks[i][record->row]);
+  }
+
+  new_chunk->enabled[new_row] = old_chunk->enabled[record->row] & new_mask;
+
+  world_remove_row(world, record->archetype, record->chunk, record->row);
+
+  record->mask = (record->mask & SPARSE_COMPONENTS) | new_mask;
+  record->archetype = new_index;
+  record->chunk = new_chunk_index;
+  record->row = new_row;
+}
+
+/*
+ * Copies `data` into the entity's `kind` column, moving the entity to
+ * the archetype that includes `kind` if needed
+ * Sparse components are stored in the kind's pool instead
+ * The component starts out enabled
+ *
+ * Returns a pointer to the stored component, or NULL for a stale handle
+ * NOTE: Pointers into chunks are invalidated by any later structural
+ * change (spawning, despawning, adding components), do not hold on to
+ * them across frames; hold on to the EntityId instead
+ * */
+void* world_add_component(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind,
+  const void* data
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL)
+    return NULL;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    record->mask |= CK_BIT(kind);
+    return pool_add(&world->pools[kind], entity, data, world->change_tick);
+  }
+
+  if (!(record->mask & CK_BIT(kind))) {
+    world_move_entity(world, record, entity,
+      (record->mask | CK_BIT(kind)) & ~SPARSE_COMPONENTS);
+  }
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+  struct Chunk* chunk = archetype->chunks[record->chunk];
+
+  void* component =
+    (unsigned char*)chunk_column(archetype, chunk, kind)
+      + record->row * COMPONENT_SIZES[kind];
+
+  memcpy(component, data, COMPONENT_SIZES[kind]);
+  chunk->enabled[record->row] |= CK_BIT(kind);
+  chunk_mark_changed(archetype, chunk, kind, record->row, world->change_tick);
+
+  return component;
+}
+
+/*
+ * Detaches a component from an entity, moving it to the archetype
+ * without `kind`
+ * Does nothing if the entity does not have the component
+ * */
+void world_remove_component(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    pool_remove(&world->pools[kind], entity);
+    record->mask &= ~CK_BIT(kind);
+    return;
+  }
+
+  world_move_entity(world, record, entity,
+    record->mask & ~(CK_BIT(kind) | SPARSE_COMPONENTS));
+}
+
+GLboolean world_has_component(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  struct EntityRecord* record = world_record(world, entity);
+
+  return (record != NULL && (record->mask & CK_BIT(kind)))
+    ? GL_TRUE
+    : GL_FALSE;
+}
+
+/*
+ * Returns the entity's component of the given kind, or NULL if the
+ * entity does not have one or the handle is stale
+ * Runs in constant time: one mask test and one table lookup
+ * */
+void* world_get_component(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return NULL;
+
+  if (IS_SPARSE_COMPONENT(kind))
+    return pool_get(&world->pools[kind], entity);
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+  void* column =
+    archetype->chunks[record->chunk]->columns[archetype->column_of[kind]];
+
+  return (unsigned char*)column + record->row * COMPONENT_SIZES[kind];
+}
+
+GLboolean world_is_component_enabled(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return GL_FALSE;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    struct ComponentPool* pool = &world->pools[kind];
+    return pool->enabled[pool->sparse[ENTITY_INDEX(entity)]];
+  }
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+
+  return (archetype->chunks[record->chunk]->enabled[record->row]
+    & CK_BIT(kind)) ? GL_TRUE : GL_FALSE;
+}
+
+void world_set_component_enabled(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind,
+  GLboolean is_enabled
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    struct ComponentPool* pool = &world->pools[kind];
+    pool->enabled[pool->sparse[ENTITY_INDEX(entity)]] = is_enabled;
+    return;
+  }
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+  struct Chunk* chunk = archetype->chunks[record->chunk];
+
+  if (is_enabled)
+    chunk->enabled[record->row] |= CK_BIT(kind);
+  else
+    chunk->enabled[record->row] &= ~CK_BIT(kind);
+}
+
+/*
+ * Starts a system run
+ * Returns the tick the system stamps its own writes with, and moves the
+ * world on so that anything written after this call is seen as newer.
+ * A system that stores the returned tick and passes it as `since` on its
+ * next run sees every change made by everyone else in between, but not
+ * its own writes
+ * */
+uint32_t world_advance_tick(struct World* world) {
+  return world->change_tick++;
+}
+
+/*
+ * Stamps an entity's component as written at `tick`
+ * */
+void world_stamp_changed(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind,
+  uint32_t tick
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    struct ComponentPool* pool = &world->pools[kind];
+    pool->changed_ticks[pool->sparse[ENTITY_INDEX(entity)]] = tick;
+    return;
+  }
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+  chunk_mark_changed(archetype, archetype->chunks[record->chunk], kind,
+    record->row, tick);
+}
+
+/*
+ * Stamps an entity's component as written at the world's current tick
+ * Call after modifying a component through a pointer obtained from
+ * world_get_component
+ * */
+void world_mark_changed(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  world_stamp_changed(world, entity, kind, world->change_tick);
+}
+
+/*
+ * Whether an entity's component was added or written after `since`
+ * */
+GLboolean world_changed_since(
+  struct World* world,
+  EntityId entity,
+  enum ComponentKind kind,
+  uint32_t since
+) {
+  struct EntityRecord* record = world_record(world, entity);
+  if (record == NULL || !(record->mask & CK_BIT(kind)))
+    return GL_FALSE;
+
+  if (IS_SPARSE_COMPONENT(kind)) {
+    struct ComponentPool* pool = &world->pools[kind];
+    return pool->changed_ticks[pool->sparse[ENTITY_INDEX(entity)]] > since
+      ? GL_TRUE
+      : GL_FALSE;
+  }
+
+  struct Archetype* archetype = &world->archetypes[record->archetype];
+  return chunk_changed_since(archetype, archetype->chunks[record->chunk],
+    kind, record->row, since);
+}
+
+/*
+ * Returns the pool of a sparse component kind
+ * Iterate pool->data as a dense array of pool->count components,
+ * pool->entities holds the owner of each one
+ * */
+struct ComponentPool* world_pool(struct World* world, enum ComponentKind kind) {
+  return &world->pools[kind];
+}
+
+/*
+ * A query caches the archetypes whose component set contains every kind
+ * in `all` and none of the kinds in `none`
+ * Only table components can be queried, sparse components are iterated
+ * through their pool (see world_pool)
+ *
+ * Archetypes are only ever appended to the world, so keeping the cache
+ * up to date only costs a mask test per archetype created since the last
+ * refresh. Entities gaining or losing components simply move between
+ * archetypes, which the cached list already covers
+ * */
+struct Query {
+  uint32_t all;
+  uint32_t none;
+
+  unsigned int* archetypes;
+  unsigned int archetype_count;
+  unsigned int reserved_archetypes;
+
+  /*
+   * Number of world archetypes already tested against the query
+   * */
+  unsigned int matched_until;
+
+  /*
+   * Flat list of non-empty matching chunks, filled by query_chunks
+   * */
+  struct QueryChunk {
+    struct Archetype* archetype;
+    struct Chunk* chunk;
+  }* chunks;
+  unsigned int chunk_count;
+  unsigned int reserved_chunks;
+};
+
+struct QueryIter {
+  struct World* world;
+  struct Query* query;
+
+  unsigned int archetype_i;
+  unsigned int chunk_i;
+
+  /*
+   * Change filter, chunks whose `changed_kind` column was not written
+   * after `changed_since` are skipped (see query_iter_changed)
+   * */
+  enum ComponentKind changed_kind;
+  uint32_t changed_since;
+  GLboolean is_filtered;
+
+  /*
+   * Current chunk, valid after query_next returns GL_TRUE
+   * */
+  struct Archetype* archetype;
+  struct Chunk* chunk;
+};
+
+void query_init(struct Query* query, uint32_t all, uint32_t none) {
+  if ((all | none) & SPARSE_COMPONENTS) {
+    fprintf(stderr, "Queries cannot filter on sparse components\n");
+  }
+
+  query->all = all;
+  query->none = none;
+
+  query->archetypes = NULL;
+  query->archetype_count = 0;
+  query->reserved_archetypes = 0;
+  query->matched_until = 0;
+
+  query->chunks = NULL;
+  query->chunk_count = 0;
+  query->reserved_chunks = 0;
+}
+
+void query_free(struct Query* query) {
+  free(query->archetypes);
+  free(query->chunks);
+
+  query_init(query, query->all, query->none);
+}
+
+/*
+ * Tests archetypes created since the last refresh against the query
+ * */
+void query_refresh(struct World* world, struct Query* query) {
+  for (; query->matched_until < world->archetype_count;
+       query->matched_until++) {
+    uint32_t mask = world->archetypes[query->matched_until].mask;
+
+    if ((mask & query->all) != query->all || (mask & query->none))
+      continue;
+
+    if (query->archetype_count >= query->reserved_archetypes) {
+      query->reserved_archetypes = query->reserved_archetypes == 0
+        ? 4
+        : query->reserved_archetypes * 2;
+      query->archetypes = realloc(
+        query->archetypes,
+        query->reserved_archetypes * sizeof(unsigned int)
+      );
+    }
+
+    query->archetypes[query->archetype_count++] = query->matched_until;
+  }
+}
+
+/*
+ * Iterates the matching chunks one at a time:
+ *
+ *  struct QueryIter it;
+ *  for (query_iter(world, query, &it); query_next(&it);) {
+ *    struct ComponentTransform* transforms =
+ *      chunk_column(it.archetype, it.chunk, CK_TRANSFORM);
+ *    for (unsigned int row = 0; row < it.chunk->count; row++) ...
+ *  }
+ *
+ * The world must not be structurally changed while iterating
+ * */
+void query_iter(
+  struct World* world,
+  struct Query* query,
+  struct QueryIter* iter
+) {
+  query_refresh(world, query);
+
+  iter->world = world;
+  iter->query = query;
+  iter->archetype_i = 0;
+  iter->chunk_i = 0;
+  iter->archetype = NULL;
+  iter->chunk = NULL;
+
+  iter->changed_kind = CK_TRANSFORM;
+  iter->changed_since = TICK_NEVER;
+  iter->is_filtered = GL_FALSE;
+}
+
+/*
+ * Like query_iter, but only visits chunks with at least one `kind`
+ * component written after `since`
+ * Filtering is per chunk: rows of a visited chunk still have to be
+ * tested with chunk_changed_since. Chunks of entities that did not move
+ * cost one compare
+ * */
+void query_iter_changed(
+  struct World* world,
+  struct Query* query,
+  enum ComponentKind kind,
+  uint32_t since,
+  struct QueryIter* iter
+) {
+  query_iter(world, query, iter);
+
+  if (!(query->all & CK_BIT(kind))) {
+    fprintf(stderr, "Change filters need a component the query requires\n");
+    return;
+  }
+
+  iter->changed_kind = kind;
+  iter->changed_since = since;
+  iter->is_filtered = GL_TRUE;
+}
+
+GLboolean query_next(struct QueryIter* iter) {
+  struct Query* query = iter->query;
+
+  while (iter->archetype_i < query->archetype_count) {
+    struct Archetype* archetype =
+      &iter->world->archetypes[query->archetypes[iter->archetype_i]];
+
+    while (iter->chunk_i < archetype->chunk_count) {
+      struct Chunk* chunk = archetype->chunks[iter->chunk_i++];
+
+      if (iter->is_filtered &&
+          chunk->column_ticks[archetype->column_of[iter->changed_kind]]
+            <= iter->changed_since)
+        continue;
+
+      iter->archetype = archetype;
+      iter->chunk = chunk;
+      return GL_TRUE;
+    }
+
+    iter->archetype_i++;
+    iter->chunk_i = 0;
+  }
+
+  return GL_FALSE;
+}
+
+/*
+ * Gathers every non-empty matching chunk into query->chunks and returns
+ * how many there are
+ * Chunks are independent of each other, so systems can split this list
+ * across threads and process each chunk without synchronization
+ * */
+unsigned int query_chunks(struct World* world, struct Query* query) {
+  query_refresh(world, query);
+
+  query->chunk_count = 0;
+
+  for (unsigned int i = 0; i < query->archetype_count; i++) {
+    struct Archetype* archetype = &world->archetypes[query->archetypes[i]];
+
+    for (unsigned int j = 0; j < archetype->chunk_count; j++) {
+      if (query->chunk_count >= query->reserved_chunks) {
+        query->reserved_chunks = query->reserved_chunks == 0
+          ? 16
+          : query->reserved_chunks * 2;
+        query->chunks = realloc(
+          query->chunks,
+          query->reserved_chunks * sizeof(struct QueryChunk)
+        );
+      }
+
+      query->chunks[query->chunk_count++] = (struct QueryChunk){
+        .archetype = archetype,
+        .chunk = archetype->chunks[j],
+      };
+    }
+  }
+
+  return query->chunk_count;
+}
+
+/*
+ * Number of entities currently matching the query
+ * */
+unsigned int query_count(struct World* world, struct Query* query) {
+  query_refresh(world, query);
+
+  unsigned int count = 0;
+  for (unsigned int i = 0; i < query->archetype_count; i++) {
+    struct Archetype* archetype = &world->archetypes[query->archetypes[i]];
+
+    if (archetype->chunk_count > 0) {
+      count += (archetype->chunk_count - 1) * CHUNK_CAPACITY +
+        archetype->chunks[archetype->chunk_count - 1]->count;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * Structural changes recorded while iterating, applied later
+ *
+ * Spawning, despawning and adding or removing components moves rows
+ * between chunks, so it must not happen while a system walks those
+ * chunks. Systems record the changes into a CommandBuffer instead, and
+ * the buffer is played back at a sync point once no iteration is in
+ * flight. A buffer is only ever touched by one thread, so systems
+ * running on separate threads each record into their own buffer
+ * */
+struct CommandBuffer {
+  struct Command {
+    enum CommandKind {
+      CMD_SPAWN,
+      CMD_DESPAWN,
+      CMD_ADD_COMPONENT,
+      CMD_REMOVE_COMPONENT,
+      CMD_CUSTOM,
+    } kind;
+
+    EntityId entity;
+
+    char* name;
+    enum ComponentKind component_kind;
+
+    /*
+     * Custom commands run `apply` on the world at playback
+     * */
+    void (*apply)(struct World* world, EntityId entity, void* data);
+
+    /*
+     * Copy of the command's data inside the buffer's payload
+     * */
+    size_t data_offset;
+  }* commands;
+  unsigned int command_count;
+  unsigned int reserved_commands;
+
+  unsigned char* payload;
+  size_t payload_size;
+  size_t reserved_payload;
+
+  /*
+   * Number of placeholder handles given out by command_buffer_spawn
+   * and, during playback, the entities they resolved to
+   * */
+  unsigned int spawn_count;
+  EntityId* spawned;
+  unsigned int reserved_spawned;
+};
+
+void command_buffer_init(struct CommandBuffer* buffer) {
+  buffer->commands = NULL;
+  buffer->command_count = 0;
+  buffer->reserved_commands = 0;
+
+  buffer->payload = NULL;
+  buffer->payload_size = 0;
+  buffer->reserved_payload = 0;
+
+  buffer->spawn_count = 0;
+  buffer->spawned = NULL;
+  buffer->reserved_spawned = 0;
+}
+
+void command_buffer_free(struct CommandBuffer* buffer) {
+  free(buffer->commands);
+  free(buffer->payload);
+  free(buffer->spawned);
+
+  command_buffer_init(buffer);
+}
+
+struct Command* command_buffer_push(
+  struct CommandBuffer* buffer,
+  enum CommandKind kind,
+  EntityId entity
+) {
+  if (buffer->command_count >= buffer->reserved_commands) {
+    buffer->reserved_commands = buffer->reserved_commands == 0
+      ? 16
+      : buffer->reserved_commands * 2;
+    buffer->commands = realloc(
+      buffer->commands,
+      buffer->reserved_commands * sizeof(struct Command)
+    );
+  }
+
+  struct Command* command = &buffer->commands[buffer->command_count++];
+  command->kind = kind;
+  command->entity = entity;
+  command->name = NULL;
+  command->apply = NULL;
+  command->data_offset = 0;
+
+  return command;
+}
+
+/*
+ * Copies `size` bytes into the payload and returns their offset
+ * Offsets stay valid when the payload grows, pointers would not
+ * */
+size_t command_buffer_copy(
+  struct CommandBuffer* buffer,
+  const void* data,
+  size_t size
+) {
+  size_t offset = (buffer->payload_size + CHUNK_COLUMN_ALIGN - 1) &
+    ~(size_t)(CHUNK_COLUMN_ALIGN - 1);
+
+  if (offset + size > buffer->reserved_payload) {
+    size_t reserved = buffer->reserved_payload == 0
+      ? 256
+      : buffer->reserved_payload;
+    while (reserved < offset + size)
+      reserved *= 2;
+
+    buffer->payload = realloc(buffer->payload, reserved);
+    buffer->reserved_payload = reserved;
+  }
+
+  memcpy(buffer->payload + offset, data, size);
+  buffer->payload_size = offset + size;
+
+  return offset;
+}
+
+/*
+ * Records the creation of an entity
+ * The returned handle is a placeholder: it can be passed to the other
+ * command_buffer_* functions of the same buffer, but not to world_*
+ * */
+EntityId command_buffer_spawn(struct CommandBuffer* buffer, char* name) {
+  EntityId entity =
+    ENTITY_ID(buffer->spawn_count++, ENTITY_GENERATION_PENDING);
+
+  command_buffer_push(buffer, CMD_SPAWN, entity)->name = name;
+
+  return entity;
+}
+
+void command_buffer_despawn(struct CommandBuffer* buffer, EntityId entity) {
+  command_buffer_push(buffer, CMD_DESPAWN, entity);
+}
+
+/*
+ * Records adding (or overwriting) a component, `data` is copied
+ * immediately and may go out of scope after the call
+ * */
+void command_buffer_add_component(
+  struct CommandBuffer* buffer,
+  EntityId entity,
+  enum ComponentKind kind,
+  const void* data
+) {
+  size_t offset = command_buffer_copy(buffer, data, COMPONENT_SIZES[kind]);
+
+  struct Command* command =
+    command_buffer_push(buffer, CMD_ADD_COMPONENT, entity);
+  command->component_kind = kind;
+  command->data_offset = offset;
+}
+
+void command_buffer_remove_component(
+  struct CommandBuffer* buffer,
+  EntityId entity,
+  enum ComponentKind kind
+) {
+  command_buffer_push(buffer, CMD_REMOVE_COMPONENT, entity)
+    ->component_kind = kind;
+}
+
+/*
+ * Records a call to `apply` with a copy of `data`, for changes that are
+ * not plain component additions or removals
+ * */
+void command_buffer_custom(
+  struct CommandBuffer* buffer,
+  EntityId entity,
+  void (*apply)(struct World* world, EntityId entity, void* data),
+  const void* data,
+  size_t size
+) {
+  size_t offset = command_buffer_copy(buffer, data, size);
+
+  struct Command* command = command_buffer_push(buffer, CMD_CUSTOM, entity);
+  command->apply = apply;
+  command->data_offset = offset;
+}
+
+EntityId command_buffer_resolve(
+  struct CommandBuffer* buffer,
+  EntityId entity
+) {
+  if (ENTITY_GENERATION(entity) != ENTITY_GENERATION_PENDING)
+    return entity;
+
+  return buffer->spawned[ENTITY_INDEX(entity)];
+}
+
+/*
+ * Applies every recorded command in order, then empties the buffer
+ * Commands targeting entities that no longer exist are skipped
+ * Must be called while no query iteration is in progress
+ * */
+void command_buffer_playback(
+  struct CommandBuffer* buffer,
+  struct World* world
+) {
+  if (buffer->spawn_count > buffer->reserved_spawned) {
+    buffer->reserved_spawned = buffer->spawn_count;
+    buffer->spawned = realloc(
+      buffer->spawned,
+      buffer->reserved_spawned * sizeof(EntityId)
+    );
+  }
+
+  for (unsigned int i = 0; i < buffer->command_count; i++) {
+    struct Command* command = &buffer->commands[i];
+
+    if (command->kind == CMD_SPAWN) {
+      buffer->spawned[ENTITY_INDEX(command->entity)] =
+        world_spawn(world, command->name);
+      continue;
+    }
+
+    EntityId entity = command_buffer_resolve(buffer, command->entity);
+    void* data = buffer->payload + command->data_offset;
+
+    switch (command->kind) {
+      case CMD_SPAWN:
+        break;
+      case CMD_DESPAWN:
+        world_despawn(world, entity);
+        break;
+      case CMD_ADD_COMPONENT:
+        world_add_component(world, entity, command->component_kind, data);
+        break;
+      case CMD_REMOVE_COMPONENT:
+        world_remove_component(world, entity, command->component_kind);
+        break;
+      case CMD_CUSTOM:
+        if (world_is_alive(world, entity))
+          command->apply(world, entity, data);
+        break;
+    }
+  }
+
+  buffer->command_count = 0;
+  buffer->payload_size = 0;
+  buffer->spawn_count = 0;
+}
+
+#endif
@@ -1,3 +1,8 @@
+#ifndef FABLE_FABLE_H
+#define FABLE_FABLE_H
+
+#include <stdint.h>
+
 #include <glad/glad.h>
 #include <cglm/cglm.h>
 
@@ -29,168 +34,264 @@ struct Context {
   int** framebuffer_size;
 };
 
-struct Entity {
+#define ROTATION_VEC_DEG(x, y, z) {glm_rad(x), glm_rad(y), glm_rad(z)}
+
+/*
+ * Generational entity handle, see fable/ecs.h
+ * */
+typedef uint32_t EntityId;
+
+#define ENTITY_NULL 0u
+
+/*
+ * One ComponentKind per component to identify its type
+ * CK_COUNT is not a component, it is the number of component kinds
+ * and is used to size per-kind tables
+ * */
+enum ComponentKind {
+  CK_TRANSFORM,
+  CK_MESH_FILTER,
+  CK_MESH_RENDERER,
+  CK_MATERIAL,
+  CK_LIGHT,
+  CK_CAMERA,
+  CK_RIGIDBODY,
+  CK_BOX_COLLIDER,
+  CK_COUNT,
+};
+
+struct ComponentTransform {
+  /*
+   * Position and scale both have the same units
+   * */
+  vec3 position;
+
+  /*
+   * Rotations are stored in radians,
+   * A rotation vector can be created from degrees using the
+   * ROTATION_VEC_DEG macro:
+   *  vec3 rot_rad = ROTATION_VEC_DEG(45.0f, 0.0f, 90.0f);
+   * */
+  vec3 rotation;
+
+  vec3 scale;
+
+  /*
+   * Transform this one is relative to, ENTITY_NULL for root transforms
+   * Change it through transform_set_parent so the hierarchy is reordered
+   * */
+  EntityId parent;
+
+  /*
+   * Cached local-to-world matrix
+   * Rebuilt by transform_hierarchy_update only when the transform
+   * changed since its last run or its parent's matrix changed
+   * */
+  mat4 world_matrix;
+
   /*
-   * This will come of use eventually.
+   * Inverse transpose of world_matrix's upper 3x3, rebuilt along with it
+   * Only valid up to scale, normals must be normalized after using it
    * */
-  char *name;
+  mat3 normal_matrix;
 
   /*
-   * Array of components attached to this entity
-   * We use a dynamic array for flexibility
-   * Everytime the component count exceeds the reserved count,
-   * we reallocate the array with double the previous size
+   * Bumped each time world_matrix is rebuilt, a child is stale when
+   * parent_version no longer matches its parent's version
    * */
-  struct Component *components;
-  unsigned int component_count;
-  unsigned int reserved_components;
+  unsigned int version;
+  unsigned int parent_version;
 };
 
-#define ROTATION_VEC_DEG(x, y, z) {glm_rad(x), glm_rad(y), glm_rad(z)}
+/*
+ * Quantized vertex attributes, any combination can be set
+ * - VFF_HALF_POSITION: positions as 3 half floats, padded to 8 bytes
+ * - VFF_HALF_UV: texture coords as 2 half floats
+ * - VFF_PACKED_NORMAL: normals as signed normalized 10-10-10-2
+ * Unset attributes stay 32 bit floats
+ * */
+enum VertexFormatFlag {
+  VFF_HALF_POSITION = 1 << 0,
+  VFF_HALF_UV = 1 << 1,
+  VFF_PACKED_NORMAL = 1 << 2,
+};
+
+#define VERTEX_FORMAT_FLOAT 0u
+#define VERTEX_FORMAT_COMPACT \
+  (VFF_HALF_POSITION | VFF_HALF_UV | VFF_PACKED_NORMAL)
+
+struct ComponentMeshFilter {
+  /*
+   * Default mesh kinds
+   * Each mesh kind (except CUSTOM) has a predefined set of vertices
+   * - MFK_CUBE: CUBE_VERTICES
+   * - MFK_SPHERE: TODO
+   * - MFK_PLANE: TODO
+   * */
+  enum MeshFilterKind {
+    MFK_CUBE,
+    MFK_SPHERE,
+    MFK_PLANE,
+    MFK_CUSTOM,
+  } mesh_kind;
+
+  /*
+   * The vertex array object (VAO) holding the mesh data
+   * Meshes of a MeshManager share the VAO of their arena and are told
+   * apart by `base_vertex` and `index_offset`
+   * */
+  GLuint vao;
+
+  /*
+   * Number of vertices in the mesh
+   * For the default mesh kinds, these counts are predefined
+   * */
+  unsigned int vertex_count;
+
+  /*
+   * Number of indices drawn, 0 for meshes drawn straight from their
+   * vertices
+   * `index_type` is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+   * */
+  unsigned int index_count;
+  GLenum index_type;
 
-struct Component {
   /*
-   * One ComponentKind per component to identify its type
+   * Where the mesh starts in the VAO's buffers: the vertex its indices
+   * are relative to, and the byte offset of its first index
    * */
-  enum ComponentKind {
-    CK_TRANSFORM,
-    CK_MESH_FILTER,
-    CK_MESH_RENDERER,
-    CK_MATERIAL,
-    CK_LIGHT,
-    CK_CAMERA,
-    CK_RIGIDBODY,
-    CK_BOX_COLLIDER,
-  } kind;
-
-  GLboolean is_enabled;
-
-  union {
-    struct ComponentTransform {
-      /*
-       * Position and scale both have the same units
-       * */
-      vec3 position;
-
-      /*
-       * Rotations are stored in radians,
-       * A rotation vector can be created from degrees using the
-       * ROTATION_VEC_DEG macro:
-       *  vec3 rot_rad = ROTATION_VEC_DEG(45.0f, 0.0f, 90.0f);
-       * */
-      vec3 rotation;
-
-      vec3 scale;
-    }* transform;
-
-    struct ComponentMeshFilter {
-      /*
-       * Default mesh kinds
-       * Each mesh kind (except CUSTOM) has a predefined set of vertices
-       * - MFK_CUBE: CUBE_VERTICES
-       * - MFK_SPHERE: TODO
-       * - MFK_PLANE: TODO
-       * */
-      enum MeshFilterKind {
-        MFK_CUBE,
-        MFK_SPHERE,
-        MFK_PLANE,
-        MFK_CUSTOM,
-      } mesh_kind;
-
-      /*
-       * The vertex array object (VAO) holding the mesh data
-       * For the default mesh kinds, these VAOs are generated internally
-       * */
-      GLuint vao;
-
-      /*
-       * Number of vertices in the mesh
-       * For the default mesh kinds, these counts are predefined
-       * */
-      unsigned int vertex_count;
-    }* mesh_filter;
-
-    struct ComponentMeshRenderer {
-      /*
-       * Array of materials applied to this mesh renderer
-       * */
-      struct Material** materials;
-      unsigned int material_count;
-    }* mesh_renderer;
-
-    struct ComponentLight {
-      enum LightKind {
-        LK_DIRECTIONAL,
-        LK_POINT,
-        LK_SPOT,
-      } light_kind;
-
-      union LightData {
-        struct DirLightData {
-          vec3 direction;
-
-          vec3 ambient;
-          vec3 diffuse;
-          vec3 specular;
-        } dir_light;
-      } light_data;
-
-      vec3 color;
-
-      float intensity;
-    }* light;
-
-    struct ComponentCamera {
-      float fovy;
-      float near;
-      float far;
-
-      GLboolean is_perspective;
-
-      GLboolean is_display_to_screen;
-      // Texture target;
-
-      float viewport_rect[4];
-
-      enum CameraBackgroundKind {
-        CBK_COLOR,
-        CBK_SKYBOX,
-      } background_kind;
-
-      union CameraBackgroundData {
-        vec4 color;
-        // struct Texture skybox;
-      } background_data;
-    }* camera;
-
-    struct ComponentRigidbody {
-      float mass;
-      GLboolean is_kinematic;
-
-      float linear_damping;
-
-      vec3 velocity;
-      vec3 acceleration;
-
-      vec3 angular_vel;
-      vec3 angular_acc;
-
-      vec3 force_acc;
-      vec3 torque_acc;
-
-      struct ForceGenerator* force_generators;
-      int force_generator_count;
-
-      struct TorqueGenerator* torque_generators;
-      int torque_generator_count;
-    }* rigidbody;
-
-    struct ComponentBoxCollider {
-      vec3 center;
-      vec3 size;
-    }* box_collider;
-  } data;
+  GLint base_vertex;
+  GLsizeiptr index_offset;
+
+  /*
+   * VertexFormatFlag bits the VAO's vertex buffer was packed with
+   * */
+  uint32_t vertex_format;
+
+  /*
+   * Axis aligned bounds of the mesh in model space, min then max
+   * For the default mesh kinds, these bounds are predefined
+   * */
+  vec3 local_bounds[2];
+
+  /*
+   * local_bounds under the transform's world matrix, cached by the
+   * transform hierarchy whenever it rebuilds that matrix
+   * Changing local_bounds takes a world_mark_changed on the transform
+   * */
+  vec3 world_bounds[2];
+};
+
+struct ComponentMeshRenderer {
+  /*
+   * Array of materials applied to this mesh renderer
+   * */
+  struct Material** materials;
+  unsigned int material_count;
+
+  /*
+   * Draw order bucket, every draw of a lower layer is issued before any
+   * draw of a higher one (see render_key)
+   * */
+  unsigned int layer;
+};
+
+struct ComponentLight {
+  enum LightKind {
+    LK_DIRECTIONAL,
+    LK_POINT,
+    LK_SPOT,
+  } light_kind;
+
+  union LightData {
+    struct DirLightData {
+      vec3 direction;
+
+      vec3 ambient;
+      vec3 diffuse;
+      vec3 specular;
+    } dir_light;
+
+    /*
+     * Point and spot lights are positioned by their entity's transform,
+     * `range` is the distance their contribution falls off to zero at
+     * */
+    struct PointLightData {
+      float range;
+    } point_light;
+
+    /*
+     * Cutoffs are the cosines of the angles between `direction` and the
+     * inner and outer edges of the cone
+     * */
+    struct SpotLightData {
+      float range;
+
+      vec3 direction;
+      float inner_cutoff;
+      float outer_cutoff;
+    } spot_light;
+  } light_data;
+
+  vec3 color;
+
+  float intensity;
+};
+
+struct ComponentCamera {
+  float fovy;
+  float near;
+  float far;
+
+  GLboolean is_perspective;
+
+  GLboolean is_display_to_screen;
+  // Texture target;
+
+  float viewport_rect[4];
+
+  /*
+   * Draws opaque geometry depth-only first, so the shading pass only
+   * lights the fragments that end up visible
+   * */
+  GLboolean is_depth_prepass;
+
+  enum CameraBackgroundKind {
+    CBK_COLOR,
+    CBK_SKYBOX,
+  } background_kind;
+
+  union CameraBackgroundData {
+    vec4 color;
+    // struct Texture skybox;
+  } background_data;
+};
+
+struct ComponentRigidbody {
+  float mass;
+  GLboolean is_kinematic;
+
+  float linear_damping;
+
+  vec3 velocity;
+  vec3 acceleration;
+
+  vec3 angular_vel;
+  vec3 angular_acc;
+
+  vec3 force_acc;
+  vec3 torque_acc;
+
+  struct ForceGenerator* force_generators;
+  int force_generator_count;
+
+  struct TorqueGenerator* torque_generators;
+  int torque_generator_count;
+};
+
+struct ComponentBoxCollider {
+  vec3 center;
+  vec3 size;
 };
 
 struct Texture {
@@ -311,90 +412,62 @@ static const struct TorqueGenerator BASIC_TORQUE_GENERATOR = (struct TorqueGener
   .generator_data = NULL,
 };
 
-static const unsigned int CUBE_VERTEX_COUNT = 36;
+/*
+ * Unit cube, 24 vertices so every face keeps its own normal and UVs
+ * Layout per vertex: position (3), normal (3), texture coords (2)
+ * */
+static const unsigned int CUBE_VERTEX_COUNT = 24;
+static const unsigned int CUBE_INDEX_COUNT = 36;
+
 static const float CUBE_VERTICES[] = {
-  // back face (−Z)  CCW
+  // back face (−Z)
   0.5f, -0.5f, -0.5f, 0, 0,-1, 0.0f, 0.0f,
   -0.5f, -0.5f, -0.5f, 0, 0,-1, 1.0f, 0.0f,
   -0.5f, 0.5f, -0.5f, 0, 0,-1, 1.0f, 1.0f,
-  0.5f, -0.5f, -0.5f, 0, 0,-1, 0.0f, 0.0f,
-  -0.5f, 0.5f, -0.5f, 0, 0,-1, 1.0f, 1.0f,
   0.5f, 0.5f, -0.5f, 0, 0,-1, 0.0f, 1.0f,
 
-  // front face (+Z) CCW
+  // front face (+Z)
   -0.5f, -0.5f, 0.5f, 0, 0, 1, 0.0f, 0.0f,
   0.5f, -0.5f, 0.5f, 0, 0, 1, 1.0f, 0.0f,
   0.5f, 0.5f, 0.5f, 0, 0, 1, 1.0f, 1.0f,
-  -0.5f, -0.5f, 0.5f, 0, 0, 1, 0.0f, 0.0f,
-  0.5f, 0.5f, 0.5f, 0, 0, 1, 1.0f, 1.0f,
   -0.5f, 0.5f, 0.5f, 0, 0, 1, 0.0f, 1.0f,
 
-  // left face (−X) CCW
+  // left face (−X)
   -0.5f, -0.5f, 0.5f, -1, 0, 0, 1.0f, 0.0f,
   -0.5f, 0.5f, 0.5f, -1, 0, 0, 1.0f, 1.0f,
   -0.5f, -0.5f, -0.5f, -1, 0, 0, 0.0f, 0.0f,
-  -0.5f, 0.5f, 0.5f, -1, 0, 0, 1.0f, 1.0f,
   -0.5f, 0.5f, -0.5f, -1, 0, 0, 0.0f, 1.0f,
-  -0.5f, -0.5f, -0.5f, -1, 0, 0, 0.0f, 0.0f,
 
-  // right face (+X) CCW
+  // right face (+X)
   0.5f, -0.5f, -0.5f, 1, 0, 0, 0.0f, 0.0f,
   0.5f, 0.5f, 0.5f, 1, 0, 0, 1.0f, 1.0f,
   0.5f, -0.5f, 0.5f, 1, 0, 0, 1.0f, 0.0f,
-  0.5f, -0.5f, -0.5f, 1, 0, 0, 0.0f, 0.0f,
   0.5f, 0.5f, -0.5f, 1, 0, 0, 0.0f, 1.0f,
-  0.5f, 0.5f, 0.5f, 1, 0, 0, 1.0f, 1.0f,
 
-  // bottom face (−Y) CCW
+  // bottom face (−Y)
   -0.5f, -0.5f, -0.5f, 0,-1, 0, 0.0f, 0.0f,
   0.5f, -0.5f, -0.5f, 0,-1, 0, 1.0f, 0.0f,
   0.5f, -0.5f, 0.5f, 0,-1, 0, 1.0f, 1.0f,
-  -0.5f, -0.5f, -0.5f, 0,-1, 0, 0.0f, 0.0f,
-  0.5f, -0.5f, 0.5f, 0,-1, 0, 1.0f, 1.0f,
   -0.5f, -0.5f, 0.5f, 0,-1, 0, 0.0f, 1.0f,
 
-  // top face (+Y) CCW
+  // top face (+Y)
   -0.5f, 0.5f, -0.5f, 0, 1, 0, 0.0f, 0.0f,
   -0.5f, 0.5f, 0.5f, 0, 1, 0, 1.0f, 0.0f,
   0.5f, 0.5f, 0.5f, 0, 1, 0, 1.0f, 1.0f,
-  -0.5f, 0.5f, -0.5f, 0, 1, 0, 0.0f, 0.0f,
-  0.5f, 0.5f, 0.5f, 0, 1, 0, 1.0f, 1.0f,
   0.5f, 0.5f, -0.5f, 0, 1, 0, 0.0f, 1.0f,
 };
 
-GLuint cube_vao(void) {
-  GLuint vao, vbo;
-
-  glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-
-  glBindVertexArray(vao);
-
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    sizeof(CUBE_VERTICES),
-    CUBE_VERTICES,
-    GL_STATIC_DRAW
-  );
-
-  // position attribute
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-  glEnableVertexAttribArray(0);
-
-  // normal attribute
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-
-  // texture coord attribute
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
-
-  return vao;
-}
+/*
+ * Counter-clockwise triangles, two per face
+ * */
+static const uint32_t CUBE_INDICES[] = {
+  0, 1, 2, 0, 2, 3,
+  4, 5, 6, 4, 6, 7,
+  8, 9, 10, 9, 11, 10,
+  12, 13, 14, 12, 15, 13,
+  16, 17, 18, 16, 18, 19,
+  20, 21, 22, 20, 22, 23,
+};
 
 struct CollisionManifold {
   GLboolean is_colliding;
@@ -404,3 +477,5 @@ struct CollisionManifold {
 
   vec3 contact_point;
 };
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef FABLE_GL_STATE_H
+#define FABLE_GL_STATE_H
+
+#include <stdio.h>
+
+#include <glad/glad.h>
+
+#define GL_STATE_TEXTURE_UNITS 16
+
+/*
+ * Capabilities toggled through gl_state_set_enabled
+ * */
+enum GLStateCap {
+  GSC_BLEND,
+  GSC_CULL_FACE,
+  GSC_DEPTH_TEST,
+  GSC_SCISSOR_TEST,
+  GSC_POLYGON_OFFSET_FILL,
+  GSC_COUNT,
+};
+
+static const GLenum GL_STATE_CAPS[GSC_COUNT] = {
+  [GSC_BLEND] = GL_BLEND,
+  [GSC_CULL_FACE] = GL_CULL_FACE,
+  [GSC_DEPTH_TEST] = GL_DEPTH_TEST,
+  [GSC_SCISSOR_TEST] = GL_SCISSOR_TEST,
+  [GSC_POLYGON_OFFSET_FILL] = GL_POLYGON_OFFSET_FILL,
+};
+
+/*
+ * Shadow copy of the GL state the renderer changes per draw
+ *
+ * Every setter compares against the copy and only calls into GL when the
+ * value actually changes. The copy is only right as long as the tracked
+ * state is never changed behind its back, so once gl_state_init has run
+ * all of it must go through the setters below
+ * */
+struct GLState {
+  GLuint program;
+  GLuint vertex_array;
+
+  GLenum active_texture;
+  GLuint textures[GL_STATE_TEXTURE_UNITS];
+  GLenum texture_targets[GL_STATE_TEXTURE_UNITS];
+
+  GLboolean is_enabled[GSC_COUNT];
+
+  GLenum blend_src;
+  GLenum blend_dst;
+
+  GLenum cull_face;
+
+  GLboolean is_color_write;
+  GLboolean is_depth_write;
+  GLenum depth_func;
+
+  GLenum polygon_mode;
+
+  /*
+   * Calls forwarded to GL and calls dropped as redundant since the last
+   * gl_state_reset_stats
+   * */
+  unsigned long issued_calls;
+  unsigned long skipped_calls;
+};
+
+void gl_state_reset_stats(struct GLState* state) {
+  state->issued_calls = 0;
+  state->skipped_calls = 0;
+}
+
+/*
+ * Puts GL in its default state and records it, so the copy and GL agree
+ * whatever was changed before
+ * */
+void gl_state_init(struct GLState* state) {
+  state->program = 0;
+  glUseProgram(0);
+
+  state->vertex_array = 0;
+  glBindVertexArray(0);
+
+  for (int unit = GL_STATE_TEXTURE_UNITS - 1; unit >= 0; unit--) {
+    state->textures[unit] = 0;
+    state->texture_targets[unit] = GL_TEXTURE_2D;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  state->active_texture = GL_TEXTURE0;
+
+  for (int cap = 0; cap < GSC_COUNT; cap++) {
+    state->is_enabled[cap] = GL_FALSE;
+    glDisable(GL_STATE_CAPS[cap]);
+  }
+
+  state->blend_src = GL_ONE;
+  state->blend_dst = GL_ZERO;
+  glBlendFunc(GL_ONE, GL_ZERO);
+
+  state->cull_face = GL_BACK;
+  glCullFace(GL_BACK);
+
+  state->is_color_write = GL_TRUE;
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  state->is_depth_write = GL_TRUE;
+  glDepthMask(GL_TRUE);
+
+  state->depth_func = GL_LESS;
+  glDepthFunc(GL_LESS);
+
+  state->polygon_mode = GL_FILL;
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  gl_state_reset_stats(state);
+}
+
+/*
+ * Counts the call and returns whether it has to reach GL
+ * */
+GLboolean _gl_state_changed(struct GLState* state, GLboolean is_changed) {
+  if (is_changed)
+    state->issued_calls++;
+  else
+    state->skipped_calls++;
+
+  return is_changed;
+}
+
+void gl_state_use_program(struct GLState* state, GLuint program) {
+  if (!_gl_state_changed(state, state->program != program)) return;
+
+  state->program = program;
+  glUseProgram(program);
+}
+
+void gl_state_bind_vertex_array(struct GLState* state, GLuint vertex_array) {
+  if (!_gl_state_changed(state, state->vertex_array != vertex_array)) return;
+
+  state->vertex_array = vertex_array;
+  glBindVertexArray(vertex_array);
+}
+
+/*
+ * Must be used instead of glDeleteVertexArrays for arrays that may be
+ * bound, GL unbinds a deleted array on its own
+ * */
+void gl_state_delete_vertex_array(struct GLState* state, GLuint vertex_array) {
+  if (state->vertex_array == vertex_array)
+    state->vertex_array = 0;
+
+  glDeleteVertexArrays(1, &vertex_array);
+}
+
+/*
+ * Binds `texture` to `target` of texture unit `unit`
+ * Only the last binding of each unit is tracked, a unit is expected to
+ * be used with a single target
+ * */
+void gl_state_bind_texture(
+  struct GLState* state,
+  unsigned int unit,
+  GLenum target,
+  GLuint texture
+) {
+  if (unit >= GL_STATE_TEXTURE_UNITS) {
+    fprintf(stderr, "Texture unit %u is not tracked (max %d)\n",
+      unit, GL_STATE_TEXTURE_UNITS);
+    return;
+  }
+
+  if (!_gl_state_changed(state, state->textures[unit] != texture ||
+      state->texture_targets[unit] != target))
+    return;
+
+  if (_gl_state_changed(state, state->active_texture != GL_TEXTURE0 + unit)) {
+    state->active_texture = GL_TEXTURE0 + unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+  }
+
+  state->textures[unit] = texture;
+  state->texture_targets[unit] = target;
+  glBindTexture(target, texture);
+}
+
+void gl_state_set_enabled(
+  struct GLState* state,
+  enum GLStateCap cap,
+  GLboolean is_enabled
+) {
+  is_enabled = is_enabled ? GL_TRUE : GL_FALSE;
+  if (!_gl_state_changed(state, state->is_enabled[cap] != is_enabled))
+    return;
+
+  state->is_enabled[cap] = is_enabled;
+  if (is_enabled)
+    glEnable(GL_STATE_CAPS[cap]);
+  else
+    glDisable(GL_STATE_CAPS[cap]);
+}
+
+void gl_state_blend_func(struct GLState* state, GLenum src, GLenum dst) {
+  if (!_gl_state_changed(state,
+      state->blend_src != src || state->blend_dst != dst))
+    return;
+
+  state->blend_src = src;
+  state->blend_dst = dst;
+  glBlendFunc(src, dst);
+}
+
+void gl_state_cull_face(struct GLState* state, GLenum face) {
+  if (!_gl_state_changed(state, state->cull_face != face)) return;
+
+  state->cull_face = face;
+  glCullFace(face);
+}
+
+/*
+ * Enables or disables writes to every color channel at once
+ * */
+void gl_state_color_mask(struct GLState* state, GLboolean is_color_write) {
+  is_color_write = is_color_write ? GL_TRUE : GL_FALSE;
+  if (!_gl_state_changed(state, state->is_color_write != is_color_write))
+    return;
+
+  state->is_color_write = is_color_write;
+  glColorMask(is_color_write, is_color_write, is_color_write,
+    is_color_write);
+}
+
+void gl_state_depth_mask(struct GLState* state, GLboolean is_depth_write) {
+  is_depth_write = is_depth_write ? GL_TRUE : GL_FALSE;
+  if (!_gl_state_changed(state, state->is_depth_write != is_depth_write))
+    return;
+
+  state->is_depth_write = is_depth_write;
+  glDepthMask(is_depth_write);
+}
+
+void gl_state_depth_func(struct GLState* state, GLenum func) {
+  if (!_gl_state_changed(state, state->depth_func != func)) return;
+
+  state->depth_func = func;
+  glDepthFunc(func);
+}
+
+/*
+ * Sets the mode of both faces, the only one the renderer uses
+ * */
+void gl_state_polygon_mode(struct GLState* state, GLenum mode) {
+  if (!_gl_state_changed(state, state->polygon_mode != mode)) return;
+
+  state->polygon_mode = mode;
+  glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef FABLE_INSTANCE_BUFFER_H
+#define FABLE_INSTANCE_BUFFER_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+/*
+ * Attribute locations of the per-instance inputs of main.vert
+ * A mat4 takes four consecutive locations and a mat3 three
+ * */
+#define INSTANCE_MODEL_LOCATION 3
+#define INSTANCE_NORMAL_MATRIX_LOCATION 7
+
+struct InstanceData {
+  mat4 model;
+  mat3 normal_matrix;
+};
+
+/*
+ * Per-instance data of every draw of a frame, written on the CPU in draw
+ * order and uploaded to a single streamed vertex buffer
+ * A batch of instanced draws reads a contiguous range of it, selected with
+ * instance_buffer_bind
+ * */
+struct InstanceBuffer {
+  GLuint vbo;
+
+  struct InstanceData* instances;
+  unsigned int count;
+  unsigned int reserved;
+};
+
+void instance_buffer_init(struct InstanceBuffer* buffer) {
+  glGenBuffers(1, &buffer->vbo);
+
+  buffer->instances = NULL;
+  buffer->count = 0;
+  buffer->reserved = 0;
+}
+
+void instance_buffer_free(struct InstanceBuffer* buffer) {
+  glDeleteBuffers(1, &buffer->vbo);
+  free(buffer->instances);
+
+  buffer->vbo = 0;
+  buffer->instances = NULL;
+  buffer->count = 0;
+  buffer->reserved = 0;
+}
+
+void instance_buffer_clear(struct InstanceBuffer* buffer) {
+  buffer->count = 0;
+}
+
+void instance_buffer_push(
+  struct InstanceBuffer* buffer,
+  mat4 model,
+  mat3 normal_matrix
+) {
+  if (buffer->count >= buffer->reserved) {
+    buffer->reserved = buffer->reserved == 0 ? 64 : buffer->reserved * 2;
+    buffer->instances = realloc(buffer->instances,
+      buffer->reserved * sizeof(struct InstanceData));
+  }
+
+  struct InstanceData* instance = &buffer->instances[buffer->count++];
+
+  glm_mat4_copy(model, instance->model);
+  glm_mat3_copy(normal_matrix, instance->normal_matrix);
+}
+
+/*
+ * Uploads the frame's instances, orphaning last frame's storage so the
+ * upload does not wait on draws still reading it
+ * */
+void instance_buffer_upload(struct InstanceBuffer* buffer) {
+  GLsizeiptr size = buffer->count * sizeof(struct InstanceData);
+
+  glBindBuffer(GL_ARRAY_BUFFER, buffer->vbo);
+  glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, size, buffer->instances);
+}
+
+/*
+ * Points the instance attributes of the bound VAO at the instances
+ * starting at `first`
+ * GL 3.3 has no base instance, so the offset is applied here instead of
+ * in the draw call
+ * */
+void instance_buffer_bind(struct InstanceBuffer* buffer, unsigned int first) {
+  GLsizei stride = sizeof(struct InstanceData);
+  size_t base = first * sizeof(struct InstanceData);
+
+  glBindBuffer(GL_ARRAY_BUFFER, buffer->vbo);
+
+  for (int column = 0; column < 4; column++) {
+    GLuint location = INSTANCE_MODEL_LOCATION + column;
+    size_t offset = base + offsetof(struct InstanceData, model)
+      + column * sizeof(vec4);
+
+    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride,
+      (void*)offset);
+    glVertexAttribDivisor(location, 1);
+    glEnableVertexAttribArray(location);
+  }
+
+  for (int column = 0; column < 3; column++) {
+    GLuint location = INSTANCE_NORMAL_MATRIX_LOCATION + column;
+    size_t offset = base + offsetof(struct InstanceData, normal_matrix)
+      + column * sizeof(vec3);
+
+    glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride,
+      (void*)offset);
+    glVertexAttribDivisor(location, 1);
+    glEnableVertexAttribArray(location);
+  }
+}
+
+#endif
@@ -0,0 +1,510 @@
+#ifndef FABLE_MESH_H
+#define FABLE_MESH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "fable/fable.h"
+
+/*
+ * Floats per vertex of the source data handed to mesh_init:
+ * position (3), normal (3), texture coords (2)
+ * */
+#define MESH_SOURCE_STRIDE 8
+
+/*
+ * Initial arena sizes in bytes, arenas double when they run out
+ * */
+#define MESH_ARENA_VERTEX_BYTES (1 << 20)
+#define MESH_ARENA_INDEX_BYTES (1 << 18)
+
+#define MESH_MAX_ARENAS 8
+
+/*
+ * Vertex and index storage shared by every mesh of one vertex format
+ *
+ * Meshes are appended to the two buffers and never moved relative to
+ * them, a mesh is addressed by its first vertex (the base vertex) and the
+ * byte offset of its indices. The VAO is the same for all of them, so
+ * switching between meshes of an arena binds nothing
+ * 16 and 32 bit index runs can share the index buffer, 32 bit runs are
+ * kept 4 byte aligned
+ * */
+struct MeshArena {
+  uint32_t vertex_format;
+  GLsizei vertex_size;
+
+  GLuint vao;
+  GLuint vbo;
+  GLuint ibo;
+
+  GLsizeiptr vertex_capacity;
+  GLsizeiptr vertex_used;
+
+  GLsizeiptr index_capacity;
+  GLsizeiptr index_used;
+};
+
+/*
+ * Owns every arena, meshes are added to the arena of their format
+ * */
+struct MeshManager {
+  struct MeshArena arenas[MESH_MAX_ARENAS];
+  unsigned int arena_count;
+};
+
+/*
+ * Rounds to the nearest half float, out of range values become infinity
+ * and NaN stays NaN
+ * */
+uint16_t _float_to_half(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000u;
+  int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFFu;
+
+  if (((bits >> 23) & 0xFF) == 0xFF)
+    return sign | 0x7C00u | (mantissa ? 0x200u : 0);
+
+  if (exponent >= 31)
+    return sign | 0x7C00u;
+
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;
+
+    // subnormal half, shift in the implicit bit
+    mantissa |= 0x800000u;
+    uint32_t shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t middle = 1u << (shift - 1);
+
+    if (rest > middle || (rest == middle && (half & 1))) half++;
+    return sign | half;
+  }
+
+  uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1FFFu;
+
+  // a carry out of the mantissa correctly bumps the exponent
+  if (rest > 0x1000u || (rest == 0x1000u && (half & 1))) half++;
+  return (uint16_t)half;
+}
+
+/*
+ * Packs a unit vector as GL_INT_2_10_10_10_REV, x in the low bits and w
+ * left at 0
+ * */
+uint32_t _pack_snorm_10_10_10_2(const float* normal) {
+  uint32_t packed = 0;
+
+  for (int axis = 0; axis < 3; axis++) {
+    float value = glm_clamp(normal[axis], -1.0f, 1.0f);
+    int32_t quantized = (int32_t)roundf(value * 511.0f);
+
+    packed |= ((uint32_t)quantized & 0x3FFu) << (axis * 10);
+  }
+
+  return packed;
+}
+
+GLsizei mesh_vertex_size(uint32_t vertex_format) {
+  GLsizei size = 0;
+
+  size += vertex_format & VFF_HALF_POSITION ? 4 * sizeof(uint16_t)
+    : 3 * sizeof(float);
+  size += vertex_format & VFF_PACKED_NORMAL ? sizeof(uint32_t)
+    : 3 * sizeof(float);
+  size += vertex_format & VFF_HALF_UV ? 2 * sizeof(uint16_t)
+    : 2 * sizeof(float);
+
+  return size;
+}
+
+/*
+ * Writes `vertex_count` source vertices into `out` in `vertex_format`,
+ * attributes interleaved as position, normal, texture coords
+ * */
+void mesh_pack_vertices(
+  const float* vertices,
+  unsigned int vertex_count,
+  uint32_t vertex_format,
+  unsigned char* out
+) {
+  for (unsigned int i = 0; i < vertex_count; i++) {
+    const float* source = &vertices[i * MESH_SOURCE_STRIDE];
+
+    if (vertex_format & VFF_HALF_POSITION) {
+      uint16_t position[4] = {
+        _float_to_half(source[0]),
+        _float_to_half(source[1]),
+        _float_to_half(source[2]),
+        0,
+      };
+      memcpy(out, position, sizeof(position));
+      out += sizeof(position);
+    } else {
+      memcpy(out, source, 3 * sizeof(float));
+      out += 3 * sizeof(float);
+    }
+
+    if (vertex_format & VFF_PACKED_NORMAL) {
+      uint32_t normal = _pack_snorm_10_10_10_2(&source[3]);
+      memcpy(out, &normal, sizeof(normal));
+      out += sizeof(normal);
+    } else {
+      memcpy(out, &source[3], 3 * sizeof(float));
+      out += 3 * sizeof(float);
+    }
+
+    if (vertex_format & VFF_HALF_UV) {
+      uint16_t uv[2] = {
+        _float_to_half(source[6]),
+        _float_to_half(source[7]),
+      };
+      memcpy(out, uv, sizeof(uv));
+      out += sizeof(uv);
+    } else {
+      memcpy(out, &source[6], 2 * sizeof(float));
+      out += 2 * sizeof(float);
+    }
+  }
+}
+
+/*
+ * Points attributes 0 (position), 1 (normal) and 2 (texture coords) of
+ * the bound VAO at the bound vertex buffer, starting at byte `base`
+ * */
+void mesh_vertex_attributes(uint32_t vertex_format, size_t base) {
+  GLsizei stride = mesh_vertex_size(vertex_format);
+  size_t offset = base;
+
+  if (vertex_format & VFF_HALF_POSITION) {
+    glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride,
+      (void*)offset);
+    offset += 4 * sizeof(uint16_t);
+  } else {
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+    offset += 3 * sizeof(float);
+  }
+  glEnableVertexAttribArray(0);
+
+  if (vertex_format & VFF_PACKED_NORMAL) {
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+      (void*)offset);
+    offset += sizeof(uint32_t);
+  } else {
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+    offset += 3 * sizeof(float);
+  }
+  glEnableVertexAttribArray(1);
+
+  if (vertex_format & VFF_HALF_UV) {
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+      (void*)offset);
+  } else {
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+  }
+  glEnableVertexAttribArray(2);
+}
+
+/*
+ * Points the arena's VAO at its current buffers, the previous bindings
+ * are restored so arenas can change at any time without going around
+ * GLState
+ * */
+void _mesh_arena_setup_vao(struct MeshArena* arena) {
+  GLint previous_vao, previous_buffer;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vao);
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous_buffer);
+
+  glBindVertexArray(arena->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+  mesh_vertex_attributes(arena->vertex_format, 0);
+
+  // the element buffer binding is part of the VAO
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ibo);
+
+  glBindVertexArray(previous_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, previous_buffer);
+}
+
+GLuint _mesh_arena_buffer(GLsizeiptr size) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+
+  return buffer;
+}
+
+void mesh_arena_init(struct MeshArena* arena, uint32_t vertex_format) {
+  arena->vertex_format = vertex_format;
+  arena->vertex_size = mesh_vertex_size(vertex_format);
+
+  arena->vertex_capacity = MESH_ARENA_VERTEX_BYTES;
+  arena->vertex_used = 0;
+  arena->index_capacity = MESH_ARENA_INDEX_BYTES;
+  arena->index_used = 0;
+
+  arena->vbo = _mesh_arena_buffer(arena->vertex_capacity);
+  arena->ibo = _mesh_arena_buffer(arena->index_capacity);
+
+  glGenVertexArrays(1, &arena->vao);
+  _mesh_arena_setup_vao(arena);
+}
+
+void mesh_arena_free(struct MeshArena* arena) {
+  glDeleteVertexArrays(1, &arena->vao);
+  glDeleteBuffers(1, &arena->vbo);
+  glDeleteBuffers(1, &arena->ibo);
+
+  arena->vao = 0;
+  arena->vbo = 0;
+  arena->ibo = 0;
+}
+
+/*
+ * Moves the contents of `*buffer` to a new buffer of `new_capacity`
+ * bytes, offsets into it stay valid
+ * */
+void _mesh_arena_grow(
+  GLuint* buffer,
+  GLsizeiptr used,
+  GLsizeiptr* capacity,
+  GLsizeiptr new_capacity
+) {
+  GLuint grown = _mesh_arena_buffer(new_capacity);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+    used);
+
+  glDeleteBuffers(1, buffer);
+  *buffer = grown;
+  *capacity = new_capacity;
+}
+
+/*
+ * Reserves `vertex_bytes` and `index_bytes` at the end of the arena,
+ * growing it if needed
+ * Returns the byte offsets of both ranges through the out parameters
+ * */
+void mesh_arena_alloc(
+  struct MeshArena* arena,
+  GLsizeiptr vertex_bytes,
+  GLsizeiptr index_bytes,
+  GLsizeiptr index_align,
+  GLsizeiptr* out_vertex_offset,
+  GLsizeiptr* out_index_offset
+) {
+  GLsizeiptr index_offset =
+    (arena->index_used + index_align - 1) / index_align * index_align;
+
+  GLboolean is_grown = GL_FALSE;
+
+  if (arena->vertex_used + vertex_bytes > arena->vertex_capacity) {
+    GLsizeiptr capacity = arena->vertex_capacity;
+    while (arena->vertex_used + vertex_bytes > capacity) capacity *= 2;
+
+    _mesh_arena_grow(&arena->vbo, arena->vertex_used,
+      &arena->vertex_capacity, capacity);
+    is_grown = GL_TRUE;
+  }
+
+  if (index_offset + index_bytes > arena->index_capacity) {
+    GLsizeiptr capacity = arena->index_capacity;
+    while (index_offset + index_bytes > capacity) capacity *= 2;
+
+    _mesh_arena_grow(&arena->ibo, arena->index_used,
+      &arena->index_capacity, capacity);
+    is_grown = GL_TRUE;
+  }
+
+  if (is_grown)
+    _mesh_arena_setup_vao(arena);
+
+  *out_vertex_offset = arena->vertex_used;
+  *out_index_offset = index_offset;
+
+  arena->vertex_used += vertex_bytes;
+  arena->index_used = index_offset + index_bytes;
+}
+
+void mesh_manager_init(struct MeshManager* manager) {
+  manager->arena_count = 0;
+}
+
+void mesh_manager_free(struct MeshManager* manager) {
+  for (unsigned int i = 0; i < manager->arena_count; i++) {
+    mesh_arena_free(&manager->arenas[i]);
+  }
+
+  manager->arena_count = 0;
+}
+
+/*
+ * Arena holding meshes of `vertex_format`, created on first use
+ * Returns NULL if MESH_MAX_ARENAS formats are already in use
+ * */
+struct MeshArena* mesh_manager_arena(
+  struct MeshManager* manager,
+  uint32_t vertex_format
+) {
+  for (unsigned int i = 0; i < manager->arena_count; i++) {
+    if (manager->arenas[i].vertex_format == vertex_format)
+      return &manager->arenas[i];
+  }
+
+  if (manager->arena_count >= MESH_MAX_ARENAS) {
+    fprintf(stderr, "Mesh arena limit reached (%d)\n", MESH_MAX_ARENAS);
+    return NULL;
+  }
+
+  struct MeshArena* arena = &manager->arenas[manager->arena_count++];
+  mesh_arena_init(arena, vertex_format);
+
+  return arena;
+}
+
+/*
+ * Packs a mesh into the arena of `vertex_format` and writes a mesh filter
+ * drawing it to `out_mesh_filter`
+ * `vertices` holds MESH_SOURCE_STRIDE floats per vertex, `indices` may be
+ * NULL to draw the vertices in order. Indices are relative to the mesh and
+ * stored as 16 bit whenever every vertex is reachable with them
+ * Returns GL_FALSE if the mesh is empty or no arena is available
+ * */
+GLboolean mesh_manager_add(
+  struct MeshManager* manager,
+  const float* vertices,
+  unsigned int vertex_count,
+  const uint32_t* indices,
+  unsigned int index_count,
+  uint32_t vertex_format,
+  enum MeshFilterKind mesh_kind,
+  struct ComponentMeshFilter* out_mesh_filter
+) {
+  if (vertex_count == 0) {
+    fprintf(stderr, "Cannot create a mesh without vertices\n");
+    return GL_FALSE;
+  }
+
+  struct MeshArena* arena = mesh_manager_arena(manager, vertex_format);
+  if (arena == NULL) return GL_FALSE;
+
+  if (indices == NULL) index_count = 0;
+
+  GLenum index_type = vertex_count <= 0x10000u
+    ? GL_UNSIGNED_SHORT
+    : GL_UNSIGNED_INT;
+  GLsizeiptr index_size = index_type == GL_UNSIGNED_SHORT
+    ? sizeof(uint16_t)
+    : sizeof(uint32_t);
+
+  GLsizeiptr vertex_bytes = (GLsizeiptr)vertex_count * arena->vertex_size;
+  GLsizeiptr index_bytes = (GLsizeiptr)index_count * index_size;
+
+  GLsizeiptr vertex_offset, index_offset;
+  mesh_arena_alloc(arena, vertex_bytes, index_bytes, index_size,
+    &vertex_offset, &index_offset);
+
+  unsigned char* packed = malloc(vertex_bytes);
+  mesh_pack_vertices(vertices, vertex_count, vertex_format, packed);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vbo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset, vertex_bytes,
+    packed);
+  free(packed);
+
+  if (index_count > 0) {
+    void* index_data = malloc(index_bytes);
+
+    for (unsigned int i = 0; i < index_count; i++) {
+      if (index_type == GL_UNSIGNED_SHORT)
+        ((uint16_t*)index_data)[i] = (uint16_t)indices[i];
+      else
+        ((uint32_t*)index_data)[i] = indices[i];
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->ibo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_bytes,
+      index_data);
+    free(index_data);
+  }
+
+  *out_mesh_filter = (struct ComponentMeshFilter){
+    .mesh_kind = mesh_kind,
+    .vao = arena->vao,
+    .vertex_count = vertex_count,
+    .index_count = index_count,
+    .index_type = index_type,
+    .base_vertex = (GLint)(vertex_offset / arena->vertex_size),
+    .index_offset = index_offset,
+    .vertex_format = vertex_format,
+  };
+
+  struct ComponentMeshFilter* mesh_filter = out_mesh_filter;
+  glm_vec3_copy((float*)&vertices[0], mesh_filter->local_bounds[0]);
+  glm_vec3_copy((float*)&vertices[0], mesh_filter->local_bounds[1]);
+  for (unsigned int i = 1; i < vertex_count; i++) {
+    float* position = (float*)&vertices[i * MESH_SOURCE_STRIDE];
+    glm_vec3_minv(mesh_filter->local_bounds[0], position,
+      mesh_filter->local_bounds[0]);
+    glm_vec3_maxv(mesh_filter->local_bounds[1], position,
+      mesh_filter->local_bounds[1]);
+  }
+
+  return GL_TRUE;
+}
+
+GLboolean mesh_manager_add_cube(
+  struct MeshManager* manager,
+  uint32_t vertex_format,
+  struct ComponentMeshFilter* out_mesh_filter
+) {
+  return mesh_manager_add(manager, CUBE_VERTICES, CUBE_VERTEX_COUNT,
+    CUBE_INDICES, CUBE_INDEX_COUNT, vertex_format, MFK_CUBE,
+    out_mesh_filter);
+}
+
+/*
+ * True when both filters draw the same range of the same arena
+ * */
+GLboolean mesh_filter_same_mesh(
+  struct ComponentMeshFilter* a,
+  struct ComponentMeshFilter* b
+) {
+  return a->vao == b->vao &&
+    a->base_vertex == b->base_vertex &&
+    a->index_offset == b->index_offset &&
+    a->index_count == b->index_count &&
+    a->vertex_count == b->vertex_count;
+}
+
+/*
+ * Draws `instance_count` instances of a mesh filter, its VAO must be bound
+ * */
+void mesh_draw_instanced(
+  struct ComponentMeshFilter* mesh_filter,
+  GLsizei instance_count
+) {
+  if (mesh_filter->index_count > 0) {
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+      mesh_filter->index_count, mesh_filter->index_type,
+      (void*)mesh_filter->index_offset, instance_count,
+      mesh_filter->base_vertex);
+  } else {
+    glDrawArraysInstanced(GL_TRIANGLES, mesh_filter->base_vertex,
+      mesh_filter->vertex_count, instance_count);
+  }
+}
+
+#endif
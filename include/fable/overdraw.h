@@ -0,0 +1,152 @@
+#ifndef FABLE_OVERDRAW_H
+#define FABLE_OVERDRAW_H
+
+#include <stdio.h>
+
+#include <glad/glad.h>
+
+/*
+ * Frames a query result is given to come back before its slot is reused,
+ * results that are still not available then are dropped instead of
+ * waited on
+ * */
+#define OVERDRAW_QUERY_FRAMES 3
+
+/*
+ * GL_SAMPLES_PASSED queries of a frame
+ * OQ_DEPTH counts the samples passing the depth pre-pass, which are the
+ * samples the opaque pass would shade without it. OQ_SHADED counts the
+ * samples the opaque pass actually shades
+ * */
+enum OverdrawQuery {
+  OQ_DEPTH,
+  OQ_SHADED,
+  OQ_COUNT,
+};
+
+struct OverdrawStats {
+  GLuint queries[OVERDRAW_QUERY_FRAMES][OQ_COUNT];
+  GLboolean is_pending[OVERDRAW_QUERY_FRAMES];
+  GLboolean is_prepass[OVERDRAW_QUERY_FRAMES];
+
+  unsigned int slot;
+
+  /*
+   * Totals over the frames whose results came back, indexed by whether
+   * the frame used a depth pre-pass
+   * */
+  unsigned long frames[2];
+  unsigned long long shaded_samples[2];
+  unsigned long long depth_samples;
+
+  unsigned long dropped_frames;
+};
+
+void overdraw_stats_init(struct OverdrawStats* stats) {
+  glGenQueries(OVERDRAW_QUERY_FRAMES * OQ_COUNT, &stats->queries[0][0]);
+
+  for (int i = 0; i < OVERDRAW_QUERY_FRAMES; i++) {
+    stats->is_pending[i] = GL_FALSE;
+    stats->is_prepass[i] = GL_FALSE;
+  }
+
+  stats->slot = 0;
+
+  for (int i = 0; i < 2; i++) {
+    stats->frames[i] = 0;
+    stats->shaded_samples[i] = 0;
+  }
+  stats->depth_samples = 0;
+  stats->dropped_frames = 0;
+}
+
+void overdraw_stats_free(struct OverdrawStats* stats) {
+  glDeleteQueries(OVERDRAW_QUERY_FRAMES * OQ_COUNT, &stats->queries[0][0]);
+}
+
+GLboolean _overdraw_query_available(GLuint query) {
+  GLuint is_available = GL_FALSE;
+  glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &is_available);
+  return is_available ? GL_TRUE : GL_FALSE;
+}
+
+/*
+ * Adds up the results of the frame that last used the current slot
+ * */
+void _overdraw_stats_collect(struct OverdrawStats* stats) {
+  unsigned int slot = stats->slot;
+  if (!stats->is_pending[slot]) return;
+
+  stats->is_pending[slot] = GL_FALSE;
+
+  GLuint* queries = stats->queries[slot];
+  GLboolean is_prepass = stats->is_prepass[slot];
+
+  if (!_overdraw_query_available(queries[OQ_SHADED]) ||
+      (is_prepass && !_overdraw_query_available(queries[OQ_DEPTH]))) {
+    stats->dropped_frames++;
+    return;
+  }
+
+  GLuint64 samples;
+  glGetQueryObjectui64v(queries[OQ_SHADED], GL_QUERY_RESULT, &samples);
+  stats->shaded_samples[is_prepass] += samples;
+  stats->frames[is_prepass]++;
+
+  if (is_prepass) {
+    glGetQueryObjectui64v(queries[OQ_DEPTH], GL_QUERY_RESULT, &samples);
+    stats->depth_samples += samples;
+  }
+}
+
+/*
+ * Starts measuring a frame, the results of the frame that used the same
+ * slot OVERDRAW_QUERY_FRAMES ago are collected first
+ * */
+void overdraw_stats_begin_frame(
+  struct OverdrawStats* stats,
+  GLboolean is_prepass
+) {
+  _overdraw_stats_collect(stats);
+
+  stats->is_prepass[stats->slot] = is_prepass ? GL_TRUE : GL_FALSE;
+}
+
+void overdraw_stats_begin(
+  struct OverdrawStats* stats,
+  enum OverdrawQuery query
+) {
+  glBeginQuery(GL_SAMPLES_PASSED, stats->queries[stats->slot][query]);
+}
+
+void overdraw_stats_end(void) {
+  glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void overdraw_stats_end_frame(struct OverdrawStats* stats) {
+  stats->is_pending[stats->slot] = GL_TRUE;
+  stats->slot = (stats->slot + 1) % OVERDRAW_QUERY_FRAMES;
+}
+
+void overdraw_stats_print(struct OverdrawStats* stats) {
+  if (stats->frames[0] > 0) {
+    printf("Opaque samples shaded: %llu per frame without pre-pass\n",
+      stats->shaded_samples[0] / stats->frames[0]);
+  }
+
+  if (stats->frames[1] > 0) {
+    unsigned long long depth = stats->depth_samples / stats->frames[1];
+    unsigned long long shaded = stats->shaded_samples[1] / stats->frames[1];
+    unsigned long long saved = depth > shaded ? depth - shaded : 0;
+
+    printf("Opaque samples shaded: %llu per frame with pre-pass, "
+      "%llu (%.1f%%) saved\n",
+      shaded, saved, depth > 0 ? 100.0 * saved / depth : 0.0);
+  }
+
+  if (stats->dropped_frames > 0) {
+    printf("Overdraw queries dropped: %lu frames\n", stats->dropped_frames);
+  }
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef FABLE_PREFAB_H
+#define FABLE_PREFAB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fable/fable.h"
+#include "fable/ecs.h"
+#include "fable/transform.h"
+
+/*
+ * Template entity that can be instantiated any number of times
+ *
+ * Instances get a plain copy of each template component. Pointers held by
+ * the components (ComponentMeshRenderer.materials, force generators, the
+ * mesh filter's VAO...) are copied as is, so every instance shares the
+ * data they point to instead of owning a copy. That data must outlive the
+ * instances and be treated as read-only through them
+ * */
+struct Prefab {
+  char* name;
+  uint32_t mask;
+
+  /*
+   * Template of every kind in `mask`, NULL for the others
+   * */
+  void* components[CK_COUNT];
+};
+
+void prefab_init(struct Prefab* prefab, char* name) {
+  prefab->name = name;
+  prefab->mask = 0;
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    prefab->components[kind] = NULL;
+  }
+}
+
+void prefab_free(struct Prefab* prefab) {
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    free(prefab->components[kind]);
+  }
+
+  prefab_init(prefab, prefab->name);
+}
+
+/*
+ * Copies `data` into the prefab as the template of `kind`, replacing the
+ * previous one. Returns the stored template
+ * */
+void* prefab_set_component(
+  struct Prefab* prefab,
+  enum ComponentKind kind,
+  const void* data
+) {
+  if (prefab->components[kind] == NULL)
+    prefab->components[kind] = malloc(COMPONENT_SIZES[kind]);
+
+  memcpy(prefab->components[kind], data, COMPONENT_SIZES[kind]);
+  prefab->mask |= CK_BIT(kind);
+
+  return prefab->components[kind];
+}
+
+/*
+ * Spawns `count` instances and writes their handles to `out`
+ * Table components are written straight into their archetype's chunks
+ * (see world_spawn_batch), the archetype is resolved once for the whole
+ * batch. Sparse components are added to each instance afterwards
+ * A template transform with a parent attaches every instance to it
+ * through `hierarchy`
+ * Returns the number of instances spawned
+ * */
+unsigned int prefab_instantiate_many(
+  struct World* world,
+  struct TransformHierarchy* hierarchy,
+  struct Prefab* prefab,
+  unsigned int count,
+  EntityId* out
+) {
+  unsigned int spawned = world_spawn_batch(
+    world,
+    prefab->name,
+    prefab->mask & ~SPARSE_COMPONENTS,
+    (const void* const*)prefab->components,
+    count,
+    out
+  );
+
+  for (int kind = 0; kind < CK_COUNT; kind++) {
+    if (!IS_SPARSE_COMPONENT(kind) || !(prefab->mask & CK_BIT(kind)))
+      continue;
+
+    for (unsigned int i = 0; i < spawned; i++) {
+      world_add_component(world, out[i], kind, prefab->components[kind]);
+    }
+  }
+
+  // the copied parent is not in the hierarchy's child list yet
+  struct ComponentTransform* transform = prefab->components[CK_TRANSFORM];
+  if (transform != NULL && transform->parent != ENTITY_NULL) {
+    for (unsigned int i = 0; i < spawned; i++)
+      transform_set_parent(world, hierarchy, out[i], transform->parent);
+  }
+
+  return spawned;
+}
+
+EntityId prefab_instantiate(
+  struct World* world,
+  struct TransformHierarchy* hierarchy,
+  struct Prefab* prefab
+) {
+  EntityId entity = ENTITY_NULL;
+  prefab_instantiate_many(world, hierarchy, prefab, 1, &entity);
+
+  return entity;
+}
+
+#endif
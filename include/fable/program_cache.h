@@ -0,0 +1,476 @@
+#ifndef FABLE_PROGRAM_CACHE_H
+#define FABLE_PROGRAM_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "fable/shader.h"
+
+/*
+ * ARB_get_program_binary, core in GL 4.1 and not part of the GL 3.3
+ * loader, so its entry points are loaded through GLFW
+ * */
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program,
+  GLsizei buf_size, GLsizei* length, GLenum* binary_format, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program,
+  GLenum binary_format, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program,
+  GLenum pname, GLint value);
+
+/*
+ * KHR_parallel_shader_compile, loaded the same way
+ * */
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+#define PROGRAM_CACHE_MAGIC 0x31425046u // "FPB1"
+#define PROGRAM_CACHE_PATH_MAX 512
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ull
+#define FNV_PRIME 0x100000001B3ull
+
+/*
+ * Header of a cached program binary file, followed by `length` bytes of
+ * driver-specific binary
+ * */
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t format;
+  uint32_t length;
+};
+
+/*
+ * Linked programs stored on disk, keyed by a hash of their sources,
+ * feature defines and the GL driver
+ *
+ * A hit loads the program with glProgramBinary and skips GLSL compilation
+ * entirely. A miss, a binary the driver rejects, or a driver without
+ * program binaries falls back to compiling from source, storing the
+ * result when binaries are supported
+ * */
+struct ProgramCache {
+  // leaves room for the file name in PROGRAM_CACHE_PATH_MAX
+  char directory[PROGRAM_CACHE_PATH_MAX - 32];
+
+  /*
+   * Hash of GL_VENDOR, GL_RENDERER and GL_VERSION, a driver update
+   * changes every key
+   * */
+  uint64_t driver_hash;
+
+  GLboolean is_supported;
+
+  PFNGLGETPROGRAMBINARYPROC get_program_binary;
+  PFNGLPROGRAMBINARYPROC program_binary;
+  PFNGLPROGRAMPARAMETERIPROC program_parameteri;
+
+  /*
+   * Whether compile and link status can be polled without blocking
+   * */
+  GLboolean is_parallel;
+
+  unsigned long hits;
+  unsigned long misses;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+uint64_t _fnv1a_string(uint64_t hash, const char* string) {
+  // the terminator keeps ("ab", "c") and ("a", "bc") apart
+  return fnv1a(hash, string, strlen(string) + 1);
+}
+
+GLboolean _gl_has_extension(const char* name) {
+  GLint extension_count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+
+  for (GLint i = 0; i < extension_count; i++) {
+    const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    if (extension != NULL && strcmp(extension, name) == 0)
+      return GL_TRUE;
+  }
+
+  return GL_FALSE;
+}
+
+/*
+ * The GL context must be current
+ * Binaries are stored in `directory`, which is created if missing
+ * */
+void program_cache_init(struct ProgramCache* cache, const char* directory) {
+  snprintf(cache->directory, sizeof(cache->directory), "%s", directory);
+  mkdir(cache->directory, 0755);
+
+  const char* driver_strings[] = {
+    (const char*)glGetString(GL_VENDOR),
+    (const char*)glGetString(GL_RENDERER),
+    (const char*)glGetString(GL_VERSION),
+  };
+
+  cache->driver_hash = FNV_OFFSET_BASIS;
+  for (int i = 0; i < 3; i++) {
+    cache->driver_hash = _fnv1a_string(cache->driver_hash,
+      driver_strings[i] != NULL ? driver_strings[i] : "");
+  }
+
+  cache->get_program_binary =
+    (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+  cache->program_binary =
+    (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+  cache->program_parameteri =
+    (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+
+  GLboolean has_binaries =
+    (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1)) ||
+    _gl_has_extension("GL_ARB_get_program_binary");
+
+  // drivers may expose the extension with no binary format at all
+  GLint format_count = 0;
+  if (has_binaries)
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+
+  cache->is_supported =
+    has_binaries && format_count > 0 &&
+    cache->get_program_binary != NULL &&
+    cache->program_binary != NULL &&
+    cache->program_parameteri != NULL;
+
+  PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads =
+    (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress(
+      "glMaxShaderCompilerThreadsKHR");
+
+  cache->is_parallel =
+    _gl_has_extension("GL_KHR_parallel_shader_compile") &&
+    max_shader_compiler_threads != NULL;
+
+  // let the driver pick the thread count
+  if (cache->is_parallel)
+    max_shader_compiler_threads(0xFFFFFFFF);
+
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+uint64_t program_cache_key(
+  struct ProgramCache* cache,
+  const char* vertex_source,
+  const char* fragment_source,
+  unsigned int features
+) {
+  uint64_t key = cache->driver_hash;
+  key = _fnv1a_string(key, vertex_source);
+  key = _fnv1a_string(key, fragment_source);
+  key = fnv1a(key, &features, sizeof(features));
+
+  return key;
+}
+
+void _program_cache_path(
+  struct ProgramCache* cache,
+  uint64_t key,
+  char* out_path
+) {
+  snprintf(out_path, PROGRAM_CACHE_PATH_MAX, "%s/%016llx.bin",
+    cache->directory, (unsigned long long)key);
+}
+
+/*
+ * Loads the binary stored for `key` into `program`
+ * Returns GL_FALSE when there is none or the driver rejects it
+ * */
+GLboolean _program_cache_load(
+  struct ProgramCache* cache,
+  uint64_t key,
+  struct Program* program
+) {
+  char path[PROGRAM_CACHE_PATH_MAX];
+  _program_cache_path(cache, key, path);
+
+  FILE* file = fopen(path, "rb");
+  if (!file) return GL_FALSE;
+
+  struct ProgramBinaryHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != PROGRAM_CACHE_MAGIC) {
+    fclose(file);
+    return GL_FALSE;
+  }
+
+  // the length comes from disk, a corrupt file must not size the buffer
+  long header_end = ftell(file);
+  fseek(file, 0, SEEK_END);
+  long file_end = ftell(file);
+
+  if (header.length == 0 || header_end < 0 ||
+      file_end - header_end < (long)header.length) {
+    fclose(file);
+    return GL_FALSE;
+  }
+
+  void* binary = malloc(header.length);
+  if (binary == NULL) {
+    fclose(file);
+    return GL_FALSE;
+  }
+
+  fseek(file, header_end, SEEK_SET);
+  size_t read_length = fread(binary, 1, header.length, file);
+  fclose(file);
+
+  if (read_length != header.length) {
+    free(binary);
+    return GL_FALSE;
+  }
+
+  program->id = glCreateProgram();
+  cache->program_binary(program->id, header.format, binary, header.length);
+  free(binary);
+
+  GLint is_linked = GL_FALSE;
+  glGetProgramiv(program->id, GL_LINK_STATUS, &is_linked);
+  if (!is_linked) {
+    glDeleteProgram(program->id);
+    program->id = 0;
+    return GL_FALSE;
+  }
+
+  program_reflect(program);
+
+  return GL_TRUE;
+}
+
+void _program_cache_store(
+  struct ProgramCache* cache,
+  uint64_t key,
+  struct Program* program
+) {
+  GLint length = 0;
+  glGetProgramiv(program->id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  struct ProgramBinaryHeader header = {
+    .magic = PROGRAM_CACHE_MAGIC,
+    .length = (uint32_t)length,
+  };
+
+  void* binary = malloc(length);
+  if (binary == NULL) return;
+
+  GLenum format;
+  cache->get_program_binary(program->id, length, NULL, &format, binary);
+  header.format = format;
+
+  char path[PROGRAM_CACHE_PATH_MAX];
+  _program_cache_path(cache, key, path);
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to write program cache: %s\n", path);
+    free(binary);
+    return;
+  }
+
+  GLboolean is_written =
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(binary, 1, length, file) == (size_t)length;
+
+  // a partial file would be read and rejected on every start, drop it
+  if (fclose(file) != 0 || !is_written) {
+    fprintf(stderr, "Failed to write program cache: %s\n", path);
+    remove(path);
+  }
+
+  free(binary);
+}
+
+enum ProgramBuildStatus {
+  PBS_COMPILING,
+  PBS_LINKING,
+  PBS_READY,
+  PBS_FAILED,
+};
+
+/*
+ * A program being built in the background, advanced by
+ * program_cache_poll until it is ready or failed
+ * */
+struct ProgramBuild {
+  struct Program* program;
+  enum ProgramBuildStatus status;
+
+  uint64_t key;
+  GLuint vertex_shader;
+  GLuint fragment_shader;
+};
+
+/*
+ * Starts building `program` from a vertex and a fragment shader source
+ * with `features` defined
+ * A cache hit is ready right away, a miss submits both shaders to the
+ * compiler and returns without waiting on them
+ * */
+void program_cache_submit(
+  struct ProgramCache* cache,
+  struct ProgramBuild* build,
+  struct Program* program,
+  const char* vertex_source,
+  const char* fragment_source,
+  unsigned int features
+) {
+  build->program = program;
+  build->key =
+    program_cache_key(cache, vertex_source, fragment_source, features);
+  build->vertex_shader = 0;
+  build->fragment_shader = 0;
+
+  if (cache->is_supported && _program_cache_load(cache, build->key, program)) {
+    cache->hits++;
+    build->status = PBS_READY;
+    return;
+  }
+
+  cache->misses++;
+
+  build->vertex_shader =
+    shader_submit(vertex_source, GL_VERTEX_SHADER, features);
+  build->fragment_shader =
+    shader_submit(fragment_source, GL_FRAGMENT_SHADER, features);
+  build->status = PBS_COMPILING;
+}
+
+/*
+ * Without parallel compilation there is no way to ask, and the status
+ * queries that follow wait instead
+ * */
+GLboolean _program_cache_is_complete(
+  struct ProgramCache* cache,
+  GLuint object,
+  GLboolean is_program
+) {
+  if (!cache->is_parallel) return GL_TRUE;
+
+  GLint is_complete = GL_FALSE;
+  if (is_program)
+    glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &is_complete);
+  else
+    glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &is_complete);
+
+  return is_complete ? GL_TRUE : GL_FALSE;
+}
+
+void _program_build_release_shaders(struct ProgramBuild* build) {
+  glDeleteShader(build->vertex_shader);
+  glDeleteShader(build->fragment_shader);
+
+  build->vertex_shader = 0;
+  build->fragment_shader = 0;
+}
+
+/*
+ * Advances a build as far as it can go
+ * With parallel compilation and `is_waiting` false this never blocks,
+ * stages still running are checked again on the next poll. Otherwise
+ * each stage waits for the driver, so callers should spread polls over
+ * frames
+ * Returns GL_TRUE once the build is ready or failed
+ * */
+GLboolean program_cache_poll(
+  struct ProgramCache* cache,
+  struct ProgramBuild* build,
+  GLboolean is_waiting
+) {
+  if (build->status == PBS_COMPILING) {
+    if (!is_waiting && (
+        !_program_cache_is_complete(cache, build->vertex_shader, GL_FALSE) ||
+        !_program_cache_is_complete(cache, build->fragment_shader, GL_FALSE)))
+      return GL_FALSE;
+
+    // both are checked so both logs are printed
+    GLboolean is_vertex_compiled = shader_check_compile(build->vertex_shader);
+    GLboolean is_fragment_compiled =
+      shader_check_compile(build->fragment_shader);
+
+    if (!is_vertex_compiled || !is_fragment_compiled) {
+      _program_build_release_shaders(build);
+      build->program->id = 0;
+      build->status = PBS_FAILED;
+      return GL_TRUE;
+    }
+
+    struct Program* program = build->program;
+    program->id = glCreateProgram();
+    if (cache->is_supported) {
+      cache->program_parameteri(program->id,
+        GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    glAttachShader(program->id, build->vertex_shader);
+    glAttachShader(program->id, build->fragment_shader);
+    glLinkProgram(program->id);
+
+    build->status = PBS_LINKING;
+  }
+
+  if (build->status == PBS_LINKING) {
+    if (!is_waiting &&
+        !_program_cache_is_complete(cache, build->program->id, GL_TRUE))
+      return GL_FALSE;
+
+    _program_build_release_shaders(build);
+
+    if (!program_check_link(build->program)) {
+      build->status = PBS_FAILED;
+      return GL_TRUE;
+    }
+
+    if (cache->is_supported)
+      _program_cache_store(cache, build->key, build->program);
+
+    build->status = PBS_READY;
+  }
+
+  return GL_TRUE;
+}
+
+/*
+ * Builds `program` right away, for programs that must exist before the
+ * first frame
+ * Returns GL_FALSE if compiling or linking failed
+ * */
+GLboolean program_cache_link(
+  struct ProgramCache* cache,
+  struct Program* program,
+  const char* vertex_source,
+  const char* fragment_source,
+  unsigned int features
+) {
+  struct ProgramBuild build;
+  program_cache_submit(cache, &build, program, vertex_source,
+    fragment_source, features);
+
+  program_cache_poll(cache, &build, GL_TRUE);
+
+  return build.status == PBS_READY ? GL_TRUE : GL_FALSE;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef FABLE_RENDER_QUEUE_H
+#define FABLE_RENDER_QUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fable/fable.h"
+#include "fable/shader.h"
+
+/*
+ * Sort key layout, most significant bits first
+ *
+ *   opaque:      layer:4 | 0:1 | unused:3 | program:8 | material:12 |
+ *                mesh:12 | depth:24
+ *   transparent: layer:4 | 1:1 | unused:3 | far_depth:24 | program:8 |
+ *                material:12 | mesh:12
+ *
+ * Sorting ascending groups opaque draws by state and then front to back,
+ * and draws transparent ones after them, back to front
+ * Program, material and mesh fields are hashes of the real state, draws
+ * with different state may share a field, which only costs a state switch
+ * */
+#define RENDER_KEY_LAYER_SHIFT 60
+#define RENDER_KEY_TRANSPARENT_SHIFT 59
+
+#define RENDER_KEY_DEPTH_BITS 24
+#define RENDER_KEY_DEPTH_MAX ((1u << RENDER_KEY_DEPTH_BITS) - 1)
+
+#define RENDER_KEY_LAYER_COUNT 16
+
+/*
+ * Everything needed to issue one draw, the pointers stay valid for the
+ * rest of the frame since the world is not changed structurally while
+ * systems run
+ * */
+struct DrawPacket {
+  struct Program* program;
+  struct Material* material;
+
+  struct ComponentMeshFilter* mesh_filter;
+
+  vec4* model;
+  vec3* normal_matrix;
+};
+
+struct RenderSortEntry {
+  uint64_t key;
+  unsigned int packet;
+};
+
+/*
+ * Draws collected over a frame, then sorted by key and issued in order
+ * */
+struct RenderQueue {
+  struct DrawPacket* packets;
+  struct RenderSortEntry* entries;
+
+  /*
+   * Ping-pong buffer of the radix sort
+   * */
+  struct RenderSortEntry* scratch;
+
+  unsigned int count;
+  unsigned int reserved;
+};
+
+void render_queue_init(struct RenderQueue* queue) {
+  queue->packets = NULL;
+  queue->entries = NULL;
+  queue->scratch = NULL;
+
+  queue->count = 0;
+  queue->reserved = 0;
+}
+
+void render_queue_free(struct RenderQueue* queue) {
+  free(queue->packets);
+  free(queue->entries);
+  free(queue->scratch);
+
+  render_queue_init(queue);
+}
+
+/*
+ * Empties the queue, keeping its storage for the next frame
+ * */
+void render_queue_clear(struct RenderQueue* queue) {
+  queue->count = 0;
+}
+
+uint64_t _render_key_hash(uintptr_t value, unsigned int bits) {
+  uint64_t hash = (uint64_t)value * 0x9E3779B97F4A7C15ull;
+  return hash >> (64 - bits);
+}
+
+/*
+ * `depth` is the view space distance normalized to [0, 1] between the
+ * near and far planes, values outside are clamped
+ * */
+uint64_t render_key(
+  unsigned int layer,
+  GLboolean is_transparent,
+  struct DrawPacket* packet,
+  float depth
+) {
+  if (depth < 0.0f) depth = 0.0f;
+  if (depth > 1.0f) depth = 1.0f;
+
+  uint64_t quantized = (uint64_t)(depth * RENDER_KEY_DEPTH_MAX);
+
+  uint64_t state =
+    (_render_key_hash(packet->program->id, 8) << 24) |
+    (_render_key_hash((uintptr_t)packet->material, 12) << 12) |
+    _render_key_hash(
+      ((uint64_t)packet->mesh_filter->vao << 32) |
+      (uint32_t)packet->mesh_filter->base_vertex, 12);
+
+  uint64_t key =
+    ((uint64_t)(layer % RENDER_KEY_LAYER_COUNT) << RENDER_KEY_LAYER_SHIFT);
+
+  if (is_transparent) {
+    key |= 1ull << RENDER_KEY_TRANSPARENT_SHIFT;
+    key |= (RENDER_KEY_DEPTH_MAX - quantized) << 32;
+    key |= state;
+  } else {
+    key |= state << RENDER_KEY_DEPTH_BITS;
+    key |= quantized;
+  }
+
+  return key;
+}
+
+void render_queue_push(
+  struct RenderQueue* queue,
+  uint64_t key,
+  struct DrawPacket packet
+) {
+  if (queue->count >= queue->reserved) {
+    queue->reserved = queue->reserved == 0 ? 64 : queue->reserved * 2;
+
+    queue->packets = realloc(queue->packets,
+      queue->reserved * sizeof(struct DrawPacket));
+    queue->entries = realloc(queue->entries,
+      queue->reserved * sizeof(struct RenderSortEntry));
+    queue->scratch = realloc(queue->scratch,
+      queue->reserved * sizeof(struct RenderSortEntry));
+  }
+
+  queue->packets[queue->count] = packet;
+  queue->entries[queue->count] = (struct RenderSortEntry){
+    .key = key,
+    .packet = queue->count,
+  };
+  queue->count++;
+}
+
+/*
+ * Least significant digit radix sort of the entries, one byte per pass
+ * Passes where every key has the same byte are skipped, so unused key
+ * bits cost nothing. Stable, equal keys keep their submission order
+ * */
+void render_queue_sort(struct RenderQueue* queue) {
+  unsigned int count = queue->count;
+  if (count < 2) return;
+
+  unsigned int histograms[8][256];
+  memset(histograms, 0, sizeof(histograms));
+
+  for (unsigned int i = 0; i < count; i++) {
+    uint64_t key = queue->entries[i].key;
+    for (int pass = 0; pass < 8; pass++) {
+      histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+  }
+
+  struct RenderSortEntry* source = queue->entries;
+  struct RenderSortEntry* target = queue->scratch;
+
+  for (int pass = 0; pass < 8; pass++) {
+    unsigned int* histogram = histograms[pass];
+    unsigned int shift = pass * 8;
+
+    if (histogram[(source[0].key >> shift) & 0xFF] == count) continue;
+
+    unsigned int offset = 0;
+    for (int digit = 0; digit < 256; digit++) {
+      unsigned int digit_count = histogram[digit];
+      histogram[digit] = offset;
+      offset += digit_count;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      unsigned int digit = (source[i].key >> shift) & 0xFF;
+      target[histogram[digit]++] = source[i];
+    }
+
+    struct RenderSortEntry* swap = source;
+    source = target;
+    target = swap;
+  }
+
+  // keep the sorted entries in `entries`, the other buffer is scratch
+  queue->entries = source;
+  queue->scratch = target;
+}
+
+struct DrawPacket* render_queue_packet(
+  struct RenderQueue* queue,
+  unsigned int index
+) {
+  return &queue->packets[queue->entries[index].packet];
+}
+
+#endif
@@ -0,0 +1,387 @@
+#ifndef FABLE_SCHEDULER_H
+#define FABLE_SCHEDULER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fable/fable.h"
+#include "fable/ecs.h"
+
+#define MAX_SYSTEMS 64
+#define MAX_WORKERS 32
+
+/*
+ * Access masks of a system hold CK_BIT(kind) for components, and
+ * RESOURCE_BIT(n) for data shared between systems outside of the world
+ * (the camera's matrices, the frame's light list...)
+ * Two systems conflict when one writes a bit the other reads or writes
+ * */
+#define RESOURCE_BIT(index) (1u << (CK_COUNT + (index)))
+
+/*
+ * Phases run in this order once per frame, FixedUpdate runs zero or
+ * more times in between to keep up with the fixed time step
+ * */
+enum SystemPhase {
+  SP_UPDATE,
+  SP_FIXED_UPDATE,
+  SP_LATE_UPDATE,
+  SP_COUNT,
+};
+
+struct System {
+  char* name;
+  enum SystemPhase phase;
+
+  uint32_t reads;
+  uint32_t writes;
+
+  /*
+   * Systems that talk to GL or GLFW must run on the thread owning the
+   * context, every other system may run on any worker
+   * */
+  GLboolean is_main_thread;
+  GLboolean is_enabled;
+
+  void (*run)(struct World* world, struct System* system, float delta_time);
+  void* data;
+
+  /*
+   * Structural changes recorded by the system, played back at the end
+   * of its phase
+   * */
+  struct CommandBuffer commands;
+
+  /*
+   * `this_run` is the tick to stamp writes with (see chunk_mark_changed),
+   * `last_run` the tick of the previous run to pass as `since`
+   * */
+  uint32_t last_run;
+  uint32_t this_run;
+
+  /*
+   * Position in the phase's dependency graph, systems of the same wave
+   * never conflict and run concurrently
+   * */
+  unsigned int wave;
+};
+
+/*
+ * Runs systems phase by phase
+ *
+ * Within a phase systems keep their registration order wherever they
+ * conflict: a system is placed in the wave after the last earlier system
+ * it conflicts with. Each wave is spread across a pool of worker threads,
+ * the main thread runs the wave's main-thread systems and then helps with
+ * the rest. The world is never changed structurally during a phase, every
+ * system's command buffer is played back once the phase is over
+ * */
+struct Scheduler {
+  struct System systems[MAX_SYSTEMS];
+  unsigned int system_count;
+
+  unsigned int wave_count[SP_COUNT];
+  GLboolean is_graph_dirty;
+
+  float fixed_delta_time;
+  float fixed_accumulator;
+
+  /*
+   * Upper bound of FixedUpdate runs in a single frame, so a slow frame
+   * does not snowball into ever more fixed steps
+   * */
+  unsigned int max_fixed_steps;
+
+  pthread_t workers[MAX_WORKERS];
+  unsigned int worker_count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+
+  /*
+   * Systems of the current wave handed to the workers
+   * */
+  struct System* jobs[MAX_SYSTEMS];
+  unsigned int job_count;
+  unsigned int next_job;
+  unsigned int pending_jobs;
+
+  struct World* world;
+  float delta_time;
+
+  GLboolean is_stopping;
+};
+
+void scheduler_run_system(
+  struct Scheduler* scheduler,
+  struct System* system
+) {
+  system->run(scheduler->world, system, scheduler->delta_time);
+  system->last_run = system->this_run;
+}
+
+void* _scheduler_worker(void* arg) {
+  struct Scheduler* scheduler = arg;
+
+  pthread_mutex_lock(&scheduler->lock);
+  for (;;) {
+    while (!scheduler->is_stopping &&
+           scheduler->next_job >= scheduler->job_count)
+      pthread_cond_wait(&scheduler->work_ready, &scheduler->lock);
+
+    if (scheduler->is_stopping) break;
+
+    struct System* system = scheduler->jobs[scheduler->next_job++];
+    pthread_mutex_unlock(&scheduler->lock);
+
+    scheduler_run_system(scheduler, system);
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (--scheduler->pending_jobs == 0)
+      pthread_cond_signal(&scheduler->work_done);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return NULL;
+}
+
+/*
+ * Starts one worker per additional core, capped at MAX_WORKERS
+ * `fixed_delta_time` is the step of the FixedUpdate phase in seconds
+ * */
+void scheduler_init(struct Scheduler* scheduler, float fixed_delta_time) {
+  scheduler->system_count = 0;
+  scheduler->is_graph_dirty = GL_TRUE;
+
+  for (int phase = 0; phase < SP_COUNT; phase++)
+    scheduler->wave_count[phase] = 0;
+
+  scheduler->fixed_delta_time = fixed_delta_time;
+  scheduler->fixed_accumulator = 0.0f;
+  scheduler->max_fixed_steps = 5;
+
+  scheduler->job_count = 0;
+  scheduler->next_job = 0;
+  scheduler->pending_jobs = 0;
+
+  scheduler->world = NULL;
+  scheduler->delta_time = 0.0f;
+  scheduler->is_stopping = GL_FALSE;
+
+  pthread_mutex_init(&scheduler->lock, NULL);
+  pthread_cond_init(&scheduler->work_ready, NULL);
+  pthread_cond_init(&scheduler->work_done, NULL);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int worker_count = cores > 1 ? (unsigned int)(cores - 1) : 0;
+  if (worker_count > MAX_WORKERS)
+    worker_count = MAX_WORKERS;
+
+  scheduler->worker_count = 0;
+  for (unsigned int i = 0; i < worker_count; i++) {
+    if (pthread_create(&scheduler->workers[i], NULL,
+        _scheduler_worker, scheduler) != 0) {
+      fprintf(stderr, "Failed to start scheduler worker %u\n", i);
+      break;
+    }
+
+    scheduler->worker_count++;
+  }
+}
+
+void scheduler_free(struct Scheduler* scheduler) {
+  pthread_mutex_lock(&scheduler->lock);
+  scheduler->is_stopping = GL_TRUE;
+  pthread_cond_broadcast(&scheduler->work_ready);
+  pthread_mutex_unlock(&scheduler->lock);
+
+  for (unsigned int i = 0; i < scheduler->worker_count; i++)
+    pthread_join(scheduler->workers[i], NULL);
+
+  for (unsigned int i = 0; i < scheduler->system_count; i++)
+    command_buffer_free(&scheduler->systems[i].commands);
+
+  pthread_cond_destroy(&scheduler->work_done);
+  pthread_cond_destroy(&scheduler->work_ready);
+  pthread_mutex_destroy(&scheduler->lock);
+
+  scheduler->worker_count = 0;
+  scheduler->system_count = 0;
+}
+
+/*
+ * Registers a copy of `system`, enabled, and returns where it is stored
+ * The pointer stays valid until scheduler_free
+ * Returns NULL if MAX_SYSTEMS are already registered
+ * */
+struct System* scheduler_add_system(
+  struct Scheduler* scheduler,
+  struct System system
+) {
+  if (scheduler->system_count >= MAX_SYSTEMS) {
+    fprintf(stderr, "System limit reached (%d)\n", MAX_SYSTEMS);
+    return NULL;
+  }
+
+  struct System* added = &scheduler->systems[scheduler->system_count++];
+  *added = system;
+
+  added->is_enabled = GL_TRUE;
+  added->last_run = TICK_NEVER;
+  added->this_run = TICK_NEVER;
+  added->wave = 0;
+  command_buffer_init(&added->commands);
+
+  scheduler->is_graph_dirty = GL_TRUE;
+
+  return added;
+}
+
+GLboolean systems_conflict(struct System* a, struct System* b) {
+  return ((a->writes & (b->reads | b->writes)) ||
+          (b->writes & a->reads))
+    ? GL_TRUE
+    : GL_FALSE;
+}
+
+/*
+ * Assigns every system the wave after the last earlier system of its
+ * phase it conflicts with
+ * */
+void scheduler_build_graph(struct Scheduler* scheduler) {
+  for (int phase = 0; phase < SP_COUNT; phase++)
+    scheduler->wave_count[phase] = 0;
+
+  for (unsigned int i = 0; i < scheduler->system_count; i++) {
+    struct System* system = &scheduler->systems[i];
+    system->wave = 0;
+
+    for (unsigned int j = 0; j < i; j++) {
+      struct System* earlier = &scheduler->systems[j];
+
+      if (earlier->phase == system->phase &&
+          earlier->wave >= system->wave &&
+          systems_conflict(earlier, system))
+        system->wave = earlier->wave + 1;
+    }
+
+    if (system->wave + 1 > scheduler->wave_count[system->phase])
+      scheduler->wave_count[system->phase] = system->wave + 1;
+  }
+
+  scheduler->is_graph_dirty = GL_FALSE;
+}
+
+void scheduler_run_wave(
+  struct Scheduler* scheduler,
+  enum SystemPhase phase,
+  unsigned int wave
+) {
+  struct System* main_jobs[MAX_SYSTEMS];
+  unsigned int main_job_count = 0;
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  scheduler->job_count = 0;
+  scheduler->next_job = 0;
+
+  for (unsigned int i = 0; i < scheduler->system_count; i++) {
+    struct System* system = &scheduler->systems[i];
+    if (system->phase != phase || system->wave != wave || !system->is_enabled)
+      continue;
+
+    // ticks are handed out here, systems never advance the world's tick
+    system->this_run = world_advance_tick(scheduler->world);
+
+    if (system->is_main_thread || scheduler->worker_count == 0)
+      main_jobs[main_job_count++] = system;
+    else
+      scheduler->jobs[scheduler->job_count++] = system;
+  }
+
+  scheduler->pending_jobs = scheduler->job_count;
+  if (scheduler->job_count > 0)
+    pthread_cond_broadcast(&scheduler->work_ready);
+
+  pthread_mutex_unlock(&scheduler->lock);
+
+  for (unsigned int i = 0; i < main_job_count; i++)
+    scheduler_run_system(scheduler, main_jobs[i]);
+
+  // help with whatever the workers have not picked up yet
+  pthread_mutex_lock(&scheduler->lock);
+  while (scheduler->next_job < scheduler->job_count) {
+    struct System* system = scheduler->jobs[scheduler->next_job++];
+    pthread_mutex_unlock(&scheduler->lock);
+
+    scheduler_run_system(scheduler, system);
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->pending_jobs--;
+  }
+
+  while (scheduler->pending_jobs > 0)
+    pthread_cond_wait(&scheduler->work_done, &scheduler->lock);
+  pthread_mutex_unlock(&scheduler->lock);
+}
+
+/*
+ * Runs every enabled system of one phase, then plays back their command
+ * buffers in registration order
+ * */
+void scheduler_run_phase(
+  struct Scheduler* scheduler,
+  struct World* world,
+  enum SystemPhase phase,
+  float delta_time
+) {
+  if (scheduler->is_graph_dirty)
+    scheduler_build_graph(scheduler);
+
+  scheduler->world = world;
+  scheduler->delta_time = delta_time;
+
+  for (unsigned int wave = 0; wave < scheduler->wave_count[phase]; wave++)
+    scheduler_run_wave(scheduler, phase, wave);
+
+  for (unsigned int i = 0; i < scheduler->system_count; i++) {
+    struct System* system = &scheduler->systems[i];
+    if (system->phase == phase)
+      command_buffer_playback(&system->commands, world);
+  }
+}
+
+/*
+ * Runs one frame: Update, as many FixedUpdate steps as `delta_time`
+ * accumulates, then LateUpdate
+ * Must be called from the thread owning the GL context
+ * */
+void scheduler_update(
+  struct Scheduler* scheduler,
+  struct World* world,
+  float delta_time
+) {
+  scheduler_run_phase(scheduler, world, SP_UPDATE, delta_time);
+
+  scheduler->fixed_accumulator += delta_time;
+
+  unsigned int steps = 0;
+  while (scheduler->fixed_accumulator >= scheduler->fixed_delta_time) {
+    if (steps++ >= scheduler->max_fixed_steps) {
+      scheduler->fixed_accumulator = 0.0f;
+      break;
+    }
+
+    scheduler_run_phase(scheduler, world, SP_FIXED_UPDATE,
+      scheduler->fixed_delta_time);
+    scheduler->fixed_accumulator -= scheduler->fixed_delta_time;
+  }
+
+  scheduler_run_phase(scheduler, world, SP_LATE_UPDATE, delta_time);
+}
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef FABLE_SHADER_H
+#define FABLE_SHADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+/*
+ * Must match MAX_DIR_LIGHTS in lit.frag
+ * */
+#define MAX_DIR_LIGHTS 4
+
+/*
+ * Every default-block uniform the engine's shaders declare, used to index
+ * the location table of a Program
+ * Members of struct arrays share one ID, the array element is passed
+ * separately (see program_location)
+ * Per-frame data lives in uniform blocks instead (see UniformBlock)
+ * */
+enum UniformId {
+  UNI_MATERIAL_BASE_MAP,
+  UNI_MATERIAL_SPECULAR_MAP,
+  UNI_MATERIAL_BASE_MAP_TEXTURE,
+  UNI_MATERIAL_ALPHA_CLIP_THRESHOLD,
+  UNI_MATERIAL_SMOOTHNESS,
+
+  UNI_CLUSTER_LIGHTS,
+  UNI_CLUSTER_GRID,
+  UNI_CLUSTER_INDICES,
+
+  UNI_COUNT,
+};
+
+/*
+ * Names as reflected by GL, with array indices removed:
+ * "lights[2].color" is looked up as "lights[].color" and "weights[0]" as
+ * "weights"
+ * */
+static const char* UNIFORM_NAMES[UNI_COUNT] = {
+  [UNI_MATERIAL_BASE_MAP] = "material.base_map",
+  [UNI_MATERIAL_SPECULAR_MAP] = "material.specular_map",
+  [UNI_MATERIAL_BASE_MAP_TEXTURE] = "material.base_map_texture",
+  [UNI_MATERIAL_ALPHA_CLIP_THRESHOLD] = "material.alpha_clip_threshold",
+  [UNI_MATERIAL_SMOOTHNESS] = "material.smoothness",
+
+  [UNI_CLUSTER_LIGHTS] = "cluster_lights",
+  [UNI_CLUSTER_GRID] = "cluster_grid",
+  [UNI_CLUSTER_INDICES] = "cluster_indices",
+};
+
+/*
+ * Uniform blocks shared by every program, each one is bound to the
+ * binding point equal to its UniformBlock value at link time
+ * Block layouts are std140, the structs below mirror them byte for byte
+ * */
+enum UniformBlock {
+  UB_CAMERA,
+  UB_LIGHTING,
+  UB_COUNT,
+};
+
+static const char* UNIFORM_BLOCK_NAMES[UB_COUNT] = {
+  [UB_CAMERA] = "Camera",
+  [UB_LIGHTING] = "Lighting",
+};
+
+/*
+ * layout(std140) uniform Camera
+ * */
+struct CameraBlock {
+  mat4 view;
+  mat4 projection;
+
+  // xyz used, w is padding
+  vec4 view_pos;
+};
+
+/*
+ * DirectionalLight inside the Lighting block, vec3 members are padded to
+ * 16 bytes except `color`, which shares its slot with `intensity`
+ * */
+struct DirectionalLightBlock {
+  vec4 direction;
+  vec4 ambient;
+  vec4 diffuse;
+  vec4 specular;
+  vec3 color;
+  float intensity;
+};
+
+/*
+ * layout(std140) uniform Lighting
+ * */
+struct LightingBlock {
+  // a vec3 followed by a scalar share one 16 byte slot
+  vec3 environment_ambient_color;
+  GLint num_dir_lights;
+
+  struct DirectionalLightBlock directional_lights[MAX_DIR_LIGHTS];
+
+  /*
+   * Cluster grid of clusters.h: tile counts x, y, depth slices z, and the
+   * number of point and spot lights in w
+   * */
+  GLuint cluster_size[4];
+
+  // x scale and y bias of a slice from log(view depth)
+  vec4 cluster_depth;
+
+  // x, y, width, height of the viewport the tiles divide
+  vec4 cluster_viewport;
+};
+
+/*
+ * Buffer backing one uniform block, bound once to the block's binding
+ * point and rewritten in place each frame
+ * */
+struct UniformBuffer {
+  GLuint id;
+  GLsizeiptr size;
+};
+
+void uniform_buffer_init(
+  struct UniformBuffer* buffer,
+  enum UniformBlock block,
+  GLsizeiptr size
+) {
+  buffer->size = size;
+
+  glGenBuffers(1, &buffer->id);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer->id);
+  glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, block, buffer->id);
+}
+
+void uniform_buffer_update(struct UniformBuffer* buffer, const void* data) {
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer->id);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, buffer->size, data);
+}
+
+void uniform_buffer_free(struct UniformBuffer* buffer) {
+  glDeleteBuffers(1, &buffer->id);
+  buffer->id = 0;
+}
+
+/*
+ * Compile-time features of a fragment shader
+ * Each one becomes a #define in the variant it is enabled for, so the
+ * shader selects its code paths with #ifdef instead of branching per
+ * fragment on uniforms
+ * */
+enum ShaderFeature {
+  SF_BASE_MAP_TEXTURE = 1 << 0,
+  SF_ALPHA_CLIPPING = 1 << 1,
+  SF_PRESERVE_SPEC_HIGH = 1 << 2,
+  SF_TRANSPARENT = 1 << 3,
+  SF_SPECULAR_MAP = 1 << 4,
+};
+
+#define SHADER_FEATURE_COUNT 5
+#define SHADER_VARIANT_COUNT (1 << SHADER_FEATURE_COUNT)
+
+static const char* SHADER_FEATURE_DEFINES[SHADER_FEATURE_COUNT] = {
+  "HAS_BASE_MAP_TEXTURE",
+  "ALPHA_CLIPPING",
+  "PRESERVE_SPEC_HIGH",
+  "TRANSPARENT",
+  "HAS_SPECULAR_MAP",
+};
+
+/*
+ * Returns a copy of `source` with a #define for every feature in
+ * `features`, inserted after the #version line which must stay first
+ * The result is allocated and must be freed by the caller
+ * */
+char* shader_inject_defines(const char* source, unsigned int features) {
+  const char* body = source;
+  if (strncmp(source, "#version", 8) == 0) {
+    const char* newline = strchr(source, '\n');
+    body = newline != NULL ? newline + 1 : source + strlen(source);
+  }
+
+  size_t header_length = body - source;
+  size_t length = strlen(source) + 2;
+
+  for (int feature = 0; feature < SHADER_FEATURE_COUNT; feature++) {
+    if (features & (1u << feature))
+      length += strlen("#define \n") + strlen(SHADER_FEATURE_DEFINES[feature]);
+  }
+
+  char* result = malloc(length);
+  char* cursor = result;
+
+  memcpy(cursor, source, header_length);
+  cursor += header_length;
+
+  // a #version line without a newline ends the file
+  if (header_length > 0 && cursor[-1] != '\n')
+    *cursor++ = '\n';
+
+  for (int feature = 0; feature < SHADER_FEATURE_COUNT; feature++) {
+    if (features & (1u << feature))
+      cursor += sprintf(cursor, "#define %s\n",
+        SHADER_FEATURE_DEFINES[feature]);
+  }
+
+  strcpy(cursor, body);
+
+  return result;
+}
+
+/*
+ * Starts compiling `source` with the given features defined, without
+ * waiting for the result (see shader_check_compile)
+ * */
+GLuint shader_submit(
+  const char* source,
+  GLenum shader_type,
+  unsigned int features
+) {
+  char* variant_source = shader_inject_defines(source, features);
+
+  GLuint shader = glCreateShader(shader_type);
+  glShaderSource(shader, 1, (const char* const*)&variant_source, NULL);
+  glCompileShader(shader);
+
+  free(variant_source);
+
+  return shader;
+}
+
+/*
+ * Waits for a submitted shader if it is still compiling
+ * Returns GL_FALSE and prints the info log when compilation failed
+ * */
+GLboolean shader_check_compile(GLuint shader) {
+  GLint is_compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &is_compiled);
+  if (!is_compiled) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "Failed to compile shader %u: %s\n", shader, log);
+  }
+
+  return is_compiled ? GL_TRUE : GL_FALSE;
+}
+
+/*
+ * Largest array length tracked per uniform, elements past it are
+ * ignored
+ * */
+#define UNIFORM_MAX_ELEMENTS 16
+
+#define UNIFORM_NAME_MAX 128
+
+/*
+ * Linked shader program with its uniform locations resolved once, at
+ * link time
+ * Uniforms the program does not use keep location -1, which glUniform*
+ * silently ignores
+ * */
+struct Program {
+  GLuint id;
+  GLint locations[UNI_COUNT][UNIFORM_MAX_ELEMENTS];
+};
+
+/*
+ * Splits a reflected uniform name into its UNIFORM_NAMES form and the
+ * array element it refers to
+ * */
+void _uniform_canonical_name(
+  const char* name,
+  char* out_name,
+  unsigned int* out_element
+) {
+  *out_element = 0;
+
+  const char* open = strchr(name, '[');
+  const char* close = open != NULL ? strchr(open, ']') : NULL;
+
+  if (open == NULL || close == NULL) {
+    strcpy(out_name, name);
+    return;
+  }
+
+  *out_element = (unsigned int)strtoul(open + 1, NULL, 10);
+
+  size_t prefix = open - name;
+  memcpy(out_name, name, prefix);
+
+  if (close[1] == '\0') {
+    out_name[prefix] = '\0';
+  } else {
+    out_name[prefix] = '\0';
+    strcat(out_name, "[]");
+    strcat(out_name, close + 1);
+  }
+}
+
+int _uniform_find(const char* canonical_name) {
+  for (int uniform = 0; uniform < UNI_COUNT; uniform++) {
+    if (strcmp(UNIFORM_NAMES[uniform], canonical_name) == 0)
+      return uniform;
+  }
+
+  return -1;
+}
+
+/*
+ * Fills the location table from the program's active uniforms, and binds
+ * the program's uniform blocks to their binding points
+ * */
+void program_reflect(struct Program* program) {
+  for (int uniform = 0; uniform < UNI_COUNT; uniform++) {
+    for (int element = 0; element < UNIFORM_MAX_ELEMENTS; element++) {
+      program->locations[uniform][element] = -1;
+    }
+  }
+
+  GLint uniform_count = 0;
+  glGetProgramiv(program->id, GL_ACTIVE_UNIFORMS, &uniform_count);
+
+  for (GLint i = 0; i < uniform_count; i++) {
+    char name[UNIFORM_NAME_MAX];
+    char canonical[UNIFORM_NAME_MAX];
+    GLint size;
+    GLenum type;
+
+    glGetActiveUniform(program->id, i, sizeof(name), NULL,
+      &size, &type, name);
+
+    // members of uniform blocks have no location
+    GLuint index = i;
+    GLint block_index;
+    glGetActiveUniformsiv(program->id, 1, &index,
+      GL_UNIFORM_BLOCK_INDEX, &block_index);
+    if (block_index != -1) continue;
+
+    unsigned int element;
+    _uniform_canonical_name(name, canonical, &element);
+
+    int uniform = _uniform_find(canonical);
+    if (uniform < 0) {
+      fprintf(stderr, "Program %u: unknown uniform %s\n", program->id, name);
+      continue;
+    }
+
+    if (size == 1) {
+      if (element < UNIFORM_MAX_ELEMENTS)
+        program->locations[uniform][element] =
+          glGetUniformLocation(program->id, name);
+      continue;
+    }
+
+    // arrays of basic types are reported once as "name[0]"
+    for (GLint j = 0; j < size && element + j < UNIFORM_MAX_ELEMENTS; j++) {
+      char element_name[UNIFORM_NAME_MAX + 16];
+      snprintf(element_name, sizeof(element_name), "%s[%d]", canonical,
+        (int)(element + j));
+
+      program->locations[uniform][element + j] =
+        glGetUniformLocation(program->id, element_name);
+    }
+  }
+
+  for (int block = 0; block < UB_COUNT; block++) {
+    GLuint block_index =
+      glGetUniformBlockIndex(program->id, UNIFORM_BLOCK_NAMES[block]);
+
+    if (block_index != GL_INVALID_INDEX)
+      glUniformBlockBinding(program->id, block_index, block);
+  }
+}
+
+/*
+ * Reflects the uniforms of a program that was just linked, or loaded from
+ * a binary
+ * Returns GL_FALSE and prints the link log if linking failed
+ * */
+GLboolean program_check_link(struct Program* program) {
+  GLint is_linked = GL_FALSE;
+  glGetProgramiv(program->id, GL_LINK_STATUS, &is_linked);
+  if (!is_linked) {
+    char log[1024];
+    glGetProgramInfoLog(program->id, sizeof(log), NULL, log);
+    fprintf(stderr, "Failed to link program %u: %s\n", program->id, log);
+  }
+
+  program_reflect(program);
+
+  return is_linked ? GL_TRUE : GL_FALSE;
+}
+
+/*
+ * Links a vertex and a fragment shader into `program` and reflects its
+ * uniforms
+ * Returns GL_FALSE and prints the link log if linking failed
+ * */
+GLboolean program_link(
+  struct Program* program,
+  GLuint vertex_shader,
+  GLuint fragment_shader
+) {
+  program->id = glCreateProgram();
+  glAttachShader(program->id, vertex_shader);
+  glAttachShader(program->id, fragment_shader);
+  glLinkProgram(program->id);
+
+  return program_check_link(program);
+}
+
+void program_free(struct Program* program) {
+  glDeleteProgram(program->id);
+  program->id = 0;
+}
+
+GLint program_location(
+  struct Program* program,
+  enum UniformId uniform,
+  unsigned int element
+) {
+  return element < UNIFORM_MAX_ELEMENTS
+    ? program->locations[uniform][element]
+    : -1;
+}
+
+/*
+ * Typed setters for non-array uniforms, the program must be in use
+ * */
+void program_set_int(
+  struct Program* program,
+  enum UniformId uniform,
+  GLint value
+) {
+  glUniform1i(program->locations[uniform][0], value);
+}
+
+void program_set_float(
+  struct Program* program,
+  enum UniformId uniform,
+  float value
+) {
+  glUniform1f(program->locations[uniform][0], value);
+}
+
+void program_set_vec3(
+  struct Program* program,
+  enum UniformId uniform,
+  const vec3 value
+) {
+  glUniform3fv(program->locations[uniform][0], 1, value);
+}
+
+void program_set_vec4(
+  struct Program* program,
+  enum UniformId uniform,
+  const vec4 value
+) {
+  glUniform4fv(program->locations[uniform][0], 1, value);
+}
+
+void program_set_mat4(
+  struct Program* program,
+  enum UniformId uniform,
+  mat4 value
+) {
+  glUniformMatrix4fv(program->locations[uniform][0], 1, GL_FALSE,
+    (float*)value);
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef FABLE_SHADER_VARIANTS_H
+#define FABLE_SHADER_VARIANTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include "fable/shader.h"
+#include "fable/program_cache.h"
+
+/*
+ * Every feature combination of one fragment shader, linked against a
+ * shared vertex shader through a ProgramCache
+ *
+ * Variants are built in the background the first time they are asked
+ * for, and kept until shader_variants_free. shader_variants_get returns
+ * NULL until a variant is ready, callers draw with a fallback program in
+ * the meantime. Features outside `feature_mask` are ignored, so shaders
+ * that only use some of them do not get duplicate variants
+ * */
+struct ShaderVariants {
+  struct ProgramCache* cache;
+
+  const char* vertex_source;
+  char* fragment_source;
+
+  unsigned int feature_mask;
+
+  /*
+   * Run on every newly linked variant with the variant in use, to set
+   * uniforms that never change such as sampler units. May be NULL
+   * */
+  void (*on_link)(struct Program* program);
+
+  /*
+   * A variant is requested once its program is allocated, and usable
+   * once its build is PBS_READY
+   * */
+  struct Program* programs[SHADER_VARIANT_COUNT];
+  struct ProgramBuild builds[SHADER_VARIANT_COUNT];
+
+  unsigned int pending_count;
+};
+
+/*
+ * Takes ownership of `fragment_source`, the cache and the vertex source
+ * stay owned by the caller and must outlive the variants
+ * */
+void shader_variants_init(
+  struct ShaderVariants* variants,
+  struct ProgramCache* cache,
+  const char* vertex_source,
+  char* fragment_source,
+  unsigned int feature_mask,
+  void (*on_link)(struct Program* program)
+) {
+  variants->cache = cache;
+  variants->vertex_source = vertex_source;
+  variants->fragment_source = fragment_source;
+  variants->feature_mask = feature_mask;
+  variants->on_link = on_link;
+
+  for (int i = 0; i < SHADER_VARIANT_COUNT; i++)
+    variants->programs[i] = NULL;
+
+  variants->pending_count = 0;
+}
+
+void shader_variants_free(struct ShaderVariants* variants) {
+  for (int i = 0; i < SHADER_VARIANT_COUNT; i++) {
+    if (variants->programs[i] == NULL) continue;
+
+    struct ProgramBuild* build = &variants->builds[i];
+    if (build->status == PBS_COMPILING || build->status == PBS_LINKING)
+      _program_build_release_shaders(build);
+
+    program_free(variants->programs[i]);
+    free(variants->programs[i]);
+    variants->programs[i] = NULL;
+  }
+
+  free(variants->fragment_source);
+  variants->fragment_source = NULL;
+}
+
+/*
+ * Runs `on_link` on a variant that just became ready
+ * The program bound before the call is restored, so GLState stays in sync
+ * */
+void _shader_variants_on_ready(
+  struct ShaderVariants* variants,
+  struct Program* program
+) {
+  if (variants->on_link == NULL) return;
+
+  GLint bound_program;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &bound_program);
+
+  glUseProgram(program->id);
+  variants->on_link(program);
+  glUseProgram(bound_program);
+}
+
+/*
+ * Starts building the variant for `features` unless it was already
+ * requested
+ * Must be called on the thread owning the GL context
+ * */
+void shader_variants_request(
+  struct ShaderVariants* variants,
+  unsigned int features
+) {
+  features &= variants->feature_mask;
+  if (variants->programs[features] != NULL) return;
+
+  struct Program* program = malloc(sizeof(struct Program));
+  program->id = 0;
+  variants->programs[features] = program;
+
+  struct ProgramBuild* build = &variants->builds[features];
+  program_cache_submit(variants->cache, build, program,
+    variants->vertex_source, variants->fragment_source, features);
+
+  if (build->status == PBS_READY)
+    _shader_variants_on_ready(variants, program);
+  else
+    variants->pending_count++;
+}
+
+/*
+ * Advances the variants still being built
+ * With parallel compilation every pending variant is checked without
+ * blocking. Without it a single one is finished per call, so the wait
+ * is spread over frames
+ * */
+void shader_variants_poll(struct ShaderVariants* variants) {
+  if (variants->pending_count == 0) return;
+
+  GLboolean is_parallel = variants->cache->is_parallel;
+
+  for (int i = 0; i < SHADER_VARIANT_COUNT; i++) {
+    struct ProgramBuild* build = &variants->builds[i];
+    if (variants->programs[i] == NULL) continue;
+    if (build->status == PBS_READY || build->status == PBS_FAILED) continue;
+
+    if (!program_cache_poll(variants->cache, build, GL_FALSE)) continue;
+
+    variants->pending_count--;
+    if (build->status == PBS_READY)
+      _shader_variants_on_ready(variants, build->program);
+
+    if (!is_parallel) return;
+  }
+}
+
+/*
+ * Returns the variant for `features`, requesting it on first use
+ * Returns NULL while the variant is being built or if it failed to build
+ * */
+struct Program* shader_variants_get(
+  struct ShaderVariants* variants,
+  unsigned int features
+) {
+  features &= variants->feature_mask;
+  shader_variants_request(variants, features);
+
+  return variants->builds[features].status == PBS_READY
+    ? variants->programs[features]
+    : NULL;
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef FABLE_TRANSFORM_H
+#define FABLE_TRANSFORM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fable/fable.h"
+#include "fable/ecs.h"
+
+/*
+ * Keeps ComponentTransform.world_matrix up to date
+ *
+ * Root transforms are streamed chunk by chunk, only chunks and rows
+ * written since the previous update are rebuilt. Parented transforms are
+ * kept in a separate list sorted by depth, so a single linear pass sees
+ * every parent before its children
+ * */
+struct TransformHierarchy {
+  struct Query query;
+
+  /*
+   * Every transform with a parent, parents before children
+   * */
+  EntityId* children;
+  unsigned int child_count;
+  unsigned int reserved_children;
+
+  GLboolean is_order_dirty;
+
+  /*
+   * Tick of the previous update, see world_advance_tick
+   * */
+  uint32_t last_run;
+};
+
+struct TransformDepth {
+  EntityId entity;
+  unsigned int depth;
+};
+
+void transform_hierarchy_init(struct TransformHierarchy* hierarchy) {
+  query_init(&hierarchy->query, CK_BIT(CK_TRANSFORM), 0);
+
+  hierarchy->children = NULL;
+  hierarchy->child_count = 0;
+  hierarchy->reserved_children = 0;
+
+  hierarchy->is_order_dirty = GL_FALSE;
+  hierarchy->last_run = TICK_NEVER;
+}
+
+void transform_hierarchy_free(struct TransformHierarchy* hierarchy) {
+  query_free(&hierarchy->query);
+  free(hierarchy->children);
+
+  hierarchy->children = NULL;
+  hierarchy->child_count = 0;
+  hierarchy->reserved_children = 0;
+}
+
+/*
+ * Builds the local matrix: translate, rotate X, Y, Z, then scale
+ * */
+void transform_local_matrix(
+  struct ComponentTransform* transform,
+  mat4 out
+) {
+  glm_mat4_identity(out);
+  glm_translate(out, transform->position);
+  glm_rotate_x(out, transform->rotation[0], out);
+  glm_rotate_y(out, transform->rotation[1], out);
+  glm_rotate_z(out, transform->rotation[2], out);
+  glm_scale(out, transform->scale);
+}
+
+/*
+ * Transforms whose world matrix only rotates and scales uniformly keep
+ * normals perpendicular without an inverse, their upper 3x3 is used as is
+ * */
+#define TRANSFORM_UNIFORM_SCALE_EPSILON 1e-4f
+
+void transform_normal_matrix(struct ComponentTransform* transform) {
+  mat3 basis;
+  glm_mat4_pick3(transform->world_matrix, basis);
+
+  float length_x = glm_vec3_norm2(basis[0]);
+  float length_y = glm_vec3_norm2(basis[1]);
+  float length_z = glm_vec3_norm2(basis[2]);
+  float tolerance = TRANSFORM_UNIFORM_SCALE_EPSILON * length_x;
+
+  GLboolean is_uniform =
+    fabsf(length_x - length_y) <= tolerance &&
+    fabsf(length_x - length_z) <= tolerance &&
+    fabsf(glm_vec3_dot(basis[0], basis[1])) <= tolerance &&
+    fabsf(glm_vec3_dot(basis[0], basis[2])) <= tolerance &&
+    fabsf(glm_vec3_dot(basis[1], basis[2])) <= tolerance;
+
+  if (is_uniform) {
+    glm_mat3_copy(basis, transform->normal_matrix);
+  } else {
+    glm_mat3_inv(basis, transform->normal_matrix);
+    glm_mat3_transpose(transform->normal_matrix);
+  }
+}
+
+/*
+ * Rebuilds the world matrix of a single transform from its local
+ * values and its parent's cached world matrix
+ * Used by transform_hierarchy_update and by systems that need a
+ * transform's new matrix before the next update, such as physics
+ * */
+void transform_compute_world(
+  struct World* world,
+  struct ComponentTransform* transform
+) {
+  struct ComponentTransform* parent = transform->parent == ENTITY_NULL
+    ? NULL
+    : world_get_component(world, transform->parent, CK_TRANSFORM);
+
+  if (parent == NULL) {
+    transform_local_matrix(transform, transform->world_matrix);
+  } else {
+    mat4 local;
+    transform_local_matrix(transform, local);
+    glm_mat4_mul(parent->world_matrix, local, transform->world_matrix);
+
+    transform->parent_version = parent->version;
+  }
+
+  transform_normal_matrix(transform);
+  transform->version++;
+}
+
+/*
+ * Refreshes the cached world bounds of a mesh from its transform's world
+ * matrix
+ * */
+void transform_update_bounds(
+  struct ComponentTransform* transform,
+  struct ComponentMeshFilter* mesh_filter
+) {
+  glm_aabb_transform(mesh_filter->local_bounds, transform->world_matrix,
+    mesh_filter->world_bounds);
+}
+
+/*
+ * World matrix without scale, rotation and translation only
+ * */
+void transform_world_rt(struct ComponentTransform* transform, mat4 out) {
+  glm_mat4_copy(transform->world_matrix, out);
+
+  glm_vec3_normalize(out[0]);
+  glm_vec3_normalize(out[1]);
+  glm_vec3_normalize(out[2]);
+}
+
+int _transform_depth_compare(const void* a, const void* b) {
+  unsigned int depth_a = ((const struct TransformDepth*)a)->depth;
+  unsigned int depth_b = ((const struct TransformDepth*)b)->depth;
+
+  return (depth_a > depth_b) - (depth_a < depth_b);
+}
+
+void transform_hierarchy_rebuild(
+  struct World* world,
+  struct TransformHierarchy* hierarchy
+) {
+  unsigned int count = 0;
+  unsigned int reserved = 0;
+  struct TransformDepth* depths = NULL;
+
+  struct QueryIter it;
+  for (query_iter(world, &hierarchy->query, &it); query_next(&it);) {
+    struct ComponentTransform* transforms =
+      chunk_column(it.archetype, it.chunk, CK_TRANSFORM);
+
+    for (unsigned int row = 0; row < it.chunk->count; row++) {
+      if (transforms[row].parent == ENTITY_NULL) continue;
+
+      unsigned int depth = 0;
+      struct ComponentTransform* ancestor = &transforms[row];
+      while (ancestor != NULL && ancestor->parent != ENTITY_NULL) {
+        depth++;
+        ancestor = world_get_component(world, ancestor->parent, CK_TRANSFORM);
+      }
+
+      if (count >= reserved) {
+        reserved = reserved == 0 ? 16 : reserved * 2;
+        depths = realloc(depths, reserved * sizeof(struct TransformDepth));
+      }
+
+      depths[count++] = (struct TransformDepth){
+        .entity = it.chunk->entities[row],
+        .depth = depth,
+      };
+    }
+  }
+
+  qsort(depths, count, sizeof(struct TransformDepth),
+    _transform_depth_compare);
+
+  if (count > hierarchy->reserved_children) {
+    hierarchy->reserved_children = count;
+    hierarchy->children = realloc(
+      hierarchy->children,
+      hierarchy->reserved_children * sizeof(EntityId)
+    );
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    hierarchy->children[i] = depths[i].entity;
+  }
+  hierarchy->child_count = count;
+  hierarchy->is_order_dirty = GL_FALSE;
+
+  free(depths);
+}
+
+/*
+ * Attaches `child` to `parent`, or detaches it when parent is ENTITY_NULL
+ * Both entities need a transform, and a transform cannot become its own
+ * ancestor
+ * */
+void transform_set_parent(
+  struct World* world,
+  struct TransformHierarchy* hierarchy,
+  EntityId child,
+  EntityId parent
+) {
+  struct ComponentTransform* transform =
+    world_get_component(world, child, CK_TRANSFORM);
+  if (transform == NULL) {
+    fprintf(stderr, "Cannot parent an entity without a transform\n");
+    return;
+  }
+
+  for (EntityId ancestor = parent; ancestor != ENTITY_NULL;) {
+    if (ancestor == child) {
+      fprintf(stderr, "Cannot parent a transform to its own descendant\n");
+      return;
+    }
+
+    struct ComponentTransform* ancestor_transform =
+      world_get_component(world, ancestor, CK_TRANSFORM);
+    if (ancestor_transform == NULL) {
+      fprintf(stderr, "Cannot parent to an entity without a transform\n");
+      return;
+    }
+
+    ancestor = ancestor_transform->parent;
+  }
+
+  transform->parent = parent;
+
+  world_mark_changed(world, child, CK_TRANSFORM);
+  hierarchy->is_order_dirty = GL_TRUE;
+}
+
+/*
+ * Rebuilds the world matrices that are out of date
+ * Chunks without a transform written since the previous update cost a
+ * single compare in the root pass
+ * Children rebuilt only because their parent moved are stamped with
+ * `this_run`, so later consumers of world_matrix see them as changed
+ * Mesh filters of rebuilt transforms get their world bounds refreshed,
+ * so systems running it must declare writes to CK_MESH_FILTER as well
+ * Does not touch the world's tick, so it can run on a worker thread with
+ * a tick handed out by the scheduler
+ * */
+void transform_hierarchy_run(
+  struct World* world,
+  struct TransformHierarchy* hierarchy,
+  uint32_t this_run
+) {
+  uint32_t since = hierarchy->last_run;
+
+  if (hierarchy->is_order_dirty)
+    transform_hierarchy_rebuild(world, hierarchy);
+
+  struct QueryIter it;
+  for (query_iter_changed(world, &hierarchy->query, CK_TRANSFORM, since, &it);
+       query_next(&it);) {
+    struct Chunk* chunk = it.chunk;
+    struct ComponentTransform* transforms =
+      chunk_column(it.archetype, chunk, CK_TRANSFORM);
+    struct ComponentMeshFilter* mesh_filters =
+      chunk_column(it.archetype, chunk, CK_MESH_FILTER);
+
+    for (unsigned int row = 0; row < chunk->count; row++) {
+      if (!chunk_changed_since(it.archetype, chunk, CK_TRANSFORM, row, since))
+        continue;
+      if (transforms[row].parent != ENTITY_NULL) continue;
+
+      transform_local_matrix(&transforms[row], transforms[row].world_matrix);
+      transform_normal_matrix(&transforms[row]);
+      transforms[row].version++;
+
+      if (mesh_filters != NULL)
+        transform_update_bounds(&transforms[row], &mesh_filters[row]);
+    }
+  }
+
+  for (unsigned int i = 0; i < hierarchy->child_count; i++) {
+    EntityId child = hierarchy->children[i];
+
+    struct ComponentTransform* transform =
+      world_get_component(world, child, CK_TRANSFORM);
+    if (transform == NULL || transform->parent == ENTITY_NULL) {
+      // despawned or detached, drop it from the order next frame
+      hierarchy->is_order_dirty = GL_TRUE;
+      continue;
+    }
+
+    struct ComponentTransform* parent =
+      world_get_component(world, transform->parent, CK_TRANSFORM);
+
+    if (world_changed_since(world, child, CK_TRANSFORM, since)) {
+      transform_compute_world(world, transform);
+    } else if (parent != NULL && parent->version != transform->parent_version) {
+      transform_compute_world(world, transform);
+      world_stamp_changed(world, child, CK_TRANSFORM, this_run);
+    } else {
+      continue;
+    }
+
+    struct ComponentMeshFilter* mesh_filter =
+      world_get_component(world, child, CK_MESH_FILTER);
+    if (mesh_filter != NULL)
+      transform_update_bounds(transform, mesh_filter);
+  }
+
+  hierarchy->last_run = this_run;
+}
+
+void transform_hierarchy_update(
+  struct World* world,
+  struct TransformHierarchy* hierarchy
+) {
+  transform_hierarchy_run(world, hierarchy, world_advance_tick(world));
+}
+
+#endif
@@ -0,0 +1,19 @@
+#version 330 core
+
+// see debug_draw.h
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec4 aColor;
+
+out vec4 Color;
+
+layout(std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+  vec3 view_pos;
+};
+
+void main()
+{
+  Color = aColor;
+  gl_Position = projection * view * vec4(aPos, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// depth pre-pass, only depth is written and color writes are masked off
+void main() {
+}
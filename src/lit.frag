@@ -1,11 +1,10 @@
 #version 330 core
 
 #define MAX_DIR_LIGHTS 4
-#define MINIMUM_A_THRESHOLD 0.0
 #define GAMMA 2.2
 
-#define MST_OPAQUE 0
-#define MST_TRANSPARENT 1
+// texels per light in cluster_lights, see clusters.h
+#define CLUSTER_LIGHT_TEXELS 4
 
 struct DirectionalLight {
   vec3 direction;
@@ -19,17 +18,17 @@ struct DirectionalLight {
   float intensity;
 };
 
+/*
+ * Feature defines, injected per variant (see shader_variants.h):
+ * HAS_BASE_MAP_TEXTURE, ALPHA_CLIPPING, PRESERVE_SPEC_HIGH, TRANSPARENT,
+ * HAS_SPECULAR_MAP
+ * */
 struct Material {
   vec4 base_map;
   vec3 specular_map;
 
-  int is_preserve_spec_high;
-  int surface_type;
-
   sampler2D base_map_texture;
-  int has_base_map_texture;
 
-  int is_alpha_clipping;
   float alpha_clip_threshold;
 
   float smoothness;
@@ -41,14 +40,28 @@ in vec2 TexCoords;
 
 out vec4 FragColor;
 
-uniform vec3 view_pos;
+layout(std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+  vec3 view_pos;
+};
+
+layout(std140) uniform Lighting {
+  vec3 environment_ambient_color;
+  int num_dir_lights;
+  DirectionalLight directional_lights[MAX_DIR_LIGHTS];
 
-uniform DirectionalLight directional_lights[MAX_DIR_LIGHTS];
-uniform int num_dir_lights;
+  uvec4 cluster_size;
+  vec4 cluster_depth;
+  vec4 cluster_viewport;
+};
 
 uniform Material material;
 
-uniform vec3 environment_ambient_color;
+// point and spot lights binned per cluster, see clusters.h
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer cluster_indices;
 
 /*
  * Alpha calculation with clipping
@@ -63,16 +76,50 @@ uniform vec3 environment_ambient_color;
  * |   No    |    No     |       N/A       |     Alpha       |
  * +---------+-----------+-----------------+-----------------+
  * */
-float calculate_alpha(int is_alpha_clipping, float alpha_clip_threshold, float alpha, int surface_type) {
-  if (is_alpha_clipping == 0 || alpha > alpha_clip_threshold) {
-    if (surface_type == 0) {
-      return 1.0f;
-    } else {
-      return alpha;
-    }
-  } else {
-    return 0.0f;
+float calculate_alpha(float alpha) {
+#ifdef TRANSPARENT
+  float result = alpha;
+#else
+  float result = 1.0;
+#endif
+
+#ifdef ALPHA_CLIPPING
+  result *= float(alpha > material.alpha_clip_threshold);
+#endif
+
+  return result;
+}
+
+/*
+ * Diffuse and specular light of one point or spot light, which falls off
+ * smoothly to zero at its range and, for spot lights, between the inner
+ * and outer cones
+ * */
+vec3 cluster_light(int index, vec3 norm, vec3 view_dir, float shininess) {
+  int texel = index * CLUSTER_LIGHT_TEXELS;
+  vec4 position_range = texelFetch(cluster_lights, texel);
+  vec4 color_intensity = texelFetch(cluster_lights, texel + 1);
+  vec4 direction_kind = texelFetch(cluster_lights, texel + 2);
+  vec4 cone = texelFetch(cluster_lights, texel + 3);
+
+  vec3 to_light = position_range.xyz - FragPos;
+  float distance = length(to_light);
+  vec3 light_dir = to_light / max(distance, 0.0001);
+
+  float falloff = clamp(1.0 - pow(distance / position_range.w, 2.0), 0.0, 1.0);
+  falloff *= falloff;
+
+  if (direction_kind.w > 0.5) {
+    float cos_angle = dot(-light_dir, direction_kind.xyz);
+    falloff *= smoothstep(cone.y, cone.x, cos_angle);
   }
+
+  float diff = max(dot(norm, light_dir), 0.0);
+
+  vec3 halfway = normalize(light_dir + view_dir);
+  float spec = pow(max(dot(norm, halfway), 0.0), shininess) * step(0.0, diff);
+
+  return (diff + spec) * falloff * color_intensity.rgb * color_intensity.a;
 }
 
 void main() {
@@ -83,23 +130,18 @@ void main() {
   vec3 norm = normalize(Normal);
   vec3 view_dir = normalize(view_pos - FragPos);
 
-  vec4 base_map_color = vec4(material.base_map.rgb, calculate_alpha(
-        material.is_alpha_clipping,
-        material.alpha_clip_threshold,
-        material.base_map.a,
-        material.surface_type
-      ));
-
-  if (material.has_base_map_texture == 1) {
-    // base_map_color = vec4(1.0, 0.0, 0.0, 1.0);
-    base_map_color = texture(material.base_map_texture, TexCoords);
-  }
-  // base_map_color = texture(material.base_map_texture, TexCoords);
+#ifdef HAS_BASE_MAP_TEXTURE
+  vec4 base_map_color = texture(material.base_map_texture, TexCoords);
+#else
+  vec4 base_map_color = vec4(material.base_map.rgb,
+    calculate_alpha(material.base_map.a));
+#endif
 
+#ifdef PRESERVE_SPEC_HIGH
+  vec3 reflection = material.specular_map.rgb * 0.25;
+#else
   vec3 reflection = vec3(0.0);
-  if (material.is_preserve_spec_high != 0) {
-    reflection = material.specular_map.rgb * 0.25;
-  }
+#endif
 
   for (int i = 0; i < num_dir_lights; i++) {
     DirectionalLight light = directional_lights[i];
@@ -117,20 +159,41 @@ void main() {
 
     vec3 add_lighting = (l_ambient + l_diffuse + l_specular) * base_map_color.rgb;
 
-    if (length(material.specular_map) > MINIMUM_A_THRESHOLD) {
-      float color_distance = min(length(add_lighting - material.specular_map), 1.0);
-      lighting = mix(add_lighting, material.specular_map, color_distance);
-    } else {
-      lighting += add_lighting;
-    }
-
-    if (material.is_preserve_spec_high != 0) {
-      vec3 l_reflection = vec3(dot(norm, light_dir)) * light.color;
-      l_reflection *= dot(norm, view_dir);
-      reflection += l_reflection;
-    }
+#ifdef HAS_SPECULAR_MAP
+    float color_distance = min(length(add_lighting - material.specular_map), 1.0);
+    lighting = mix(add_lighting, material.specular_map, color_distance);
+#else
+    lighting += add_lighting;
+#endif
+
+#ifdef PRESERVE_SPEC_HIGH
+    vec3 l_reflection = vec3(dot(norm, light_dir)) * light.color;
+    l_reflection *= dot(norm, view_dir);
+    reflection += l_reflection;
+#endif
   }
 
+  vec2 tile = (gl_FragCoord.xy - cluster_viewport.xy) / cluster_viewport.zw;
+  uvec3 cluster = uvec3(clamp(tile, 0.0, 0.9999) * vec2(cluster_size.xy), 0);
+
+  float view_depth = max(-(view * vec4(FragPos, 1.0)).z, 0.0001);
+  float slice = log(view_depth) * cluster_depth.x - cluster_depth.y;
+  cluster.z = uint(clamp(slice, 0.0, float(cluster_size.z - 1u)));
+
+  int cluster_index = int(
+    (cluster.z * cluster_size.y + cluster.y) * cluster_size.x + cluster.x);
+  uvec2 run = texelFetch(cluster_grid, cluster_index).xy;
+
+  float shininess = exp2(10.0 * material.smoothness + 1.0);
+
+  vec3 cluster_lighting = vec3(0.0);
+  for (uint i = 0u; i < run.y; i++) {
+    int light = int(texelFetch(cluster_indices, int(run.x + i)).r);
+    cluster_lighting += cluster_light(light, norm, view_dir, shininess);
+  }
+
+  lighting += cluster_lighting * base_map_color.rgb;
+
   vec4 refl = vec4(reflection, length(reflection));
   vec4 reflection_strength = vec4(material.specular_map, base_map_color.a) + ((1 - material.smoothness) / 4.0);
 
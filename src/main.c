@@ -11,6 +11,20 @@
 
 #include <GLFW/glfw3.h>
 #include "fable/fable.h"
+#include "fable/ecs.h"
+#include "fable/transform.h"
+#include "fable/scheduler.h"
+#include "fable/prefab.h"
+#include "fable/shader.h"
+#include "fable/shader_variants.h"
+#include "fable/render_queue.h"
+#include "fable/instance_buffer.h"
+#include "fable/gl_state.h"
+#include "fable/culling.h"
+#include "fable/mesh.h"
+#include "fable/clusters.h"
+#include "fable/overdraw.h"
+#include "fable/debug_draw.h"
 
 #define WIDTH 800
 #define HEIGHT 600
@@ -25,24 +39,13 @@
 
 #define FRAME_RATE 60.0f
 
+#define PROGRAM_CACHE_DIRECTORY "shader_cache"
+
 #define DEFAULT_RENDER_MODE GL_LINE
 
 //  TODO: Load from config file
 #define TITLE "Fable Engine"
 
-struct Component* get_comp_by_kind(
-    struct Entity *entity,
-    enum ComponentKind kind
-) {
-  for (size_t i = 0; i < entity->component_count; i++) {
-    if (entity->components[i].kind == kind) {
-      return &entity->components[i];
-    }
-  }
-
-  return NULL;
-}
-
 int read_file(const char* path, char** buffer) {
   FILE* file = fopen(path, "r");
   if (!file) {
@@ -82,36 +85,6 @@ void rgba_to_vec4(int r, int g, int b, int a, vec4* out_color) {
   (*out_color)[3] = a / 255.0f;
 }
 
-struct Entity empty_entity(void) {
-  struct Entity entity;
-  entity.name = "Empty";
-  entity.component_count = 0;
-  entity.reserved_components = 0;
-  entity.components = NULL;
-
-  return entity;
-}
-
-void add_component(
-    struct Entity* entity,
-    struct Component component
-) {
-  if (entity->reserved_components == 0) {
-    entity->reserved_components = 4;
-    entity->components = malloc(
-      entity->reserved_components * sizeof(struct Component)
-    );
-  } else if (entity->component_count >= entity->reserved_components) {
-    entity->reserved_components *= 2;
-    entity->components = realloc(
-      entity->components,
-      entity->reserved_components * sizeof(struct Component)
-    );
-  }
-
-  entity->components[entity->component_count++] = component;
-}
-
 void framebuffer_size_callback(
     GLFWwindow* window,
     int width,
@@ -189,124 +162,120 @@ struct Texture load_texture(const char* path) {
   return texture;
 }
 
-void uniform_material(GLuint program, struct Material material) {
-  GLuint has_base_map_texture_loc =
-      glGetUniformLocation(program, "material.has_base_map_texture");
-
+void uniform_material(
+  struct GLState* gl_state,
+  struct Program* program,
+  struct Material material
+) {
   if (material.base_map_texture->texture != NULL) {
     printf("Using base map texture ID: %d\n",
       material.base_map_texture->texture->id);
 
-    GLuint base_map_loc =
-        glGetUniformLocation(program, "material.base_map_texture");
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D,
+    gl_state_bind_texture(gl_state, 0, GL_TEXTURE_2D,
       material.base_map_texture->texture->id);
-    glUniform1i(base_map_loc, 0);
-
-    glUniform1i(has_base_map_texture_loc, GL_TRUE);
-  } else {
-    glUniform1i(has_base_map_texture_loc, GL_FALSE);
+    program_set_int(program, UNI_MATERIAL_BASE_MAP_TEXTURE, 0);
   }
 
-  GLuint base_map_loc =
-      glGetUniformLocation(program, "material.base_map");
-  glUniform4fv(base_map_loc, 1,
+  program_set_vec4(program, UNI_MATERIAL_BASE_MAP,
     material.base_map_texture->color);
-
-  GLuint specular_map_loc =
-      glGetUniformLocation(program, "material.specular_map");
-  glUniform3fv(specular_map_loc, 1,
+  program_set_vec3(program, UNI_MATERIAL_SPECULAR_MAP,
     material.specular_map);
-
-  GLuint smoothness_loc =
-      glGetUniformLocation(program, "material.smoothness");
-  glUniform1f(smoothness_loc,
+  program_set_float(program, UNI_MATERIAL_SMOOTHNESS,
     material.smoothness);
-
-  GLuint is_alpha_clipping_loc =
-      glGetUniformLocation(program, "material.is_alpha_clipping");
-  glUniform1i(is_alpha_clipping_loc,
-    material.is_alpha_clipping ? GL_TRUE : GL_FALSE);
-
-  GLuint alpha_clip_threshold_loc =
-      glGetUniformLocation(program, "material.alpha_clip_threshold");
-  glUniform1f(alpha_clip_threshold_loc,
+  program_set_float(program, UNI_MATERIAL_ALPHA_CLIP_THRESHOLD,
     material.alpha_clip_threshold);
+}
 
-  GLuint surface_type_loc =
-      glGetUniformLocation(program, "material.surface_type");
-  glUniform1i(surface_type_loc,
-    material.surface_type);
-
-  GLuint is_preserve_spec_high_loc =
-      glGetUniformLocation(program, "material.is_preserve_spec_high");
-  glUniform1i(is_preserve_spec_high_loc,
-    material.is_preserve_specular_highlights);
+/*
+ * Shader features a material needs, selects its shader variant
+ * */
+unsigned int material_shader_features(struct Material* material) {
+  unsigned int features = 0;
+
+  if (material->base_map_texture->texture != NULL)
+    features |= SF_BASE_MAP_TEXTURE;
+  if (material->is_alpha_clipping)
+    features |= SF_ALPHA_CLIPPING;
+  if (material->is_preserve_specular_highlights)
+    features |= SF_PRESERVE_SPEC_HIGH;
+  if (material->surface_type == MST_TRANSPARENT)
+    features |= SF_TRANSPARENT;
+  if (glm_vec3_norm(material->specular_map) > 0.0f)
+    features |= SF_SPECULAR_MAP;
+
+  return features;
 }
 
-void uniform_directional_light(
-  GLuint program,
-  int i,
-  struct DirLightData dir_light_data,
-  struct ComponentLight light_comp
+/*
+ * Blending, culling and depth state of a material
+ * Depth state is left alone when `is_depth_prepassed`, the caller sets it
+ * once for the whole pass
+ * */
+void apply_material_state(
+  struct GLState* gl_state,
+  struct Material* material,
+  GLboolean is_depth_prepassed
 ) {
-  char buffer[100];
-  sprintf(buffer, "directional_lights[%d].color", i);
-  GLuint light_color_loc =
-      glGetUniformLocation(program, buffer);
-
-  memset(buffer, 0, sizeof(buffer));
-  sprintf(buffer, "directional_lights[%d].direction", i);
-  GLuint light_direction_loc =
-      glGetUniformLocation(program, buffer);
-
-  memset(buffer, 0, sizeof(buffer));
-  sprintf(buffer, "directional_lights[%d].ambient", i);
-  GLuint light_ambient_loc =
-      glGetUniformLocation(program, buffer);
-
-  memset(buffer, 0, sizeof(buffer));
-  sprintf(buffer, "directional_lights[%d].diffuse", i);
-  GLuint light_diffuse_loc =
-      glGetUniformLocation(program, buffer);
-
-  memset(buffer, 0, sizeof(buffer));
-  sprintf(buffer, "directional_lights[%d].specular", i);
-  GLuint light_specular_loc =
-      glGetUniformLocation(program, buffer);
-
-  memset(buffer, 0, sizeof(buffer));
-  sprintf(buffer, "directional_lights[%d].intensity", i);
-  GLuint light_intensity_loc =
-      glGetUniformLocation(program, buffer);
-
-  glUniform3fv(light_ambient_loc, 1,
-    dir_light_data.ambient);
-  glUniform3fv(light_diffuse_loc, 1,
-    dir_light_data.diffuse);
-  glUniform3fv(light_specular_loc, 1,
-    dir_light_data.specular);
-  glUniform3fv(light_color_loc, 1,
-    light_comp.color);
-  glUniform3fv(light_direction_loc, 1,
-    dir_light_data.direction);
-  glUniform1f(light_intensity_loc, light_comp.intensity);
-}
+  if (!is_depth_prepassed)
+    gl_state_depth_mask(gl_state, GL_TRUE);
 
-GLuint load_shader(const char* path, GLenum shader_type) {
-  char* shader_source = NULL;
-  if (read_file(path, &shader_source) != 0)
-    return 0;
+  if (material->surface_type == MST_TRANSPARENT) {
+    gl_state_set_enabled(gl_state, GSC_BLEND, GL_TRUE);
+    gl_state_blend_func(gl_state, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  GLuint shader = glCreateShader(shader_type);
-  glShaderSource(shader, 1,
-    (const char* const*)&shader_source, NULL);
-  glCompileShader(shader);
+    gl_state_depth_func(gl_state, GL_LESS);
+
+    switch (material->render_face) {
+      case MRF_FRONT:
+        gl_state_set_enabled(gl_state, GSC_CULL_FACE, GL_TRUE);
+        gl_state_cull_face(gl_state, GL_BACK);
+        break;
+      case MRF_BACK:
+        gl_state_set_enabled(gl_state, GSC_CULL_FACE, GL_TRUE);
+        gl_state_cull_face(gl_state, GL_FRONT);
+        break;
+      case MRF_DOUBLE:
+        gl_state_set_enabled(gl_state, GSC_CULL_FACE, GL_FALSE);
+        break;
+    }
+  } else {
+    gl_state_set_enabled(gl_state, GSC_BLEND, GL_FALSE);
+
+    gl_state_set_enabled(gl_state, GSC_CULL_FACE, GL_TRUE);
+    gl_state_cull_face(gl_state, GL_BACK);
+
+    gl_state_set_enabled(gl_state, GSC_POLYGON_OFFSET_FILL, GL_FALSE);
+
+    if (!is_depth_prepassed)
+      gl_state_depth_func(gl_state, GL_LEQUAL);
+  }
+}
 
-  free(shader_source);
+/*
+ * Packs a directional light into its std140 form for the Lighting block
+ * */
+void directional_light_block(
+  struct ComponentLight* light,
+  struct DirectionalLightBlock* out_block
+) {
+  struct DirLightData* dir_light = &light->light_data.dir_light;
+
+  glm_vec4(dir_light->direction, 0.0f, out_block->direction);
+  glm_vec4(dir_light->ambient, 0.0f, out_block->ambient);
+  glm_vec4(dir_light->diffuse, 0.0f, out_block->diffuse);
+  glm_vec4(dir_light->specular, 0.0f, out_block->specular);
+  glm_vec3_copy(light->color, out_block->color);
+  out_block->intensity = light->intensity;
+}
 
-  return shader;
+/*
+ * Points the cluster samplers of a lit variant at their fixed units, see
+ * clusters.h
+ * */
+void lit_program_on_link(struct Program* program) {
+  program_set_int(program, UNI_CLUSTER_LIGHTS, CLUSTER_LIGHTS_UNIT);
+  program_set_int(program, UNI_CLUSTER_GRID, CLUSTER_GRID_UNIT);
+  program_set_int(program, UNI_CLUSTER_INDICES, CLUSTER_INDICES_UNIT);
 }
 
 void integrate_entity(
@@ -351,17 +320,17 @@ void integrate_entity(
   glm_vec3_zero(rb->torque_acc);
 }
 
+/*
+ * Uses the transform's cached world matrix, the transform must be up to
+ * date (see transform_compute_world)
+ * */
 void get_collider_obb(
   struct ComponentBoxCollider* box,
   struct ComponentTransform* transform,
   vec3 out_corners[8]
 ) {
   mat4 model;
-  glm_mat4_identity(model);
-  glm_translate(model, transform->position);
-  glm_rotate_x(model, transform->rotation[0], model);
-  glm_rotate_y(model, transform->rotation[1], model);
-  glm_rotate_z(model, transform->rotation[2], model);
+  transform_world_rt(transform, model);
 
   vec3 center_translation;
   glm_vec3_negate_to(box->center, center_translation);
@@ -546,6 +515,782 @@ void box_and_box_collision(
 #endif
 }
 
+/*
+ * Custom command recorded by the physics pass, points the entity's
+ * contact torque generator at the latest contact
+ * Installs the generator on the first contact
+ * */
+void apply_contact_torque(
+  struct World* world,
+  EntityId entity,
+  void* data
+) {
+  struct ComponentRigidbody* rigidbody =
+    world_get_component(world, entity, CK_RIGIDBODY);
+  if (rigidbody == NULL) return;
+
+  if (rigidbody->torque_generator_count == 0) {
+    rigidbody->torque_generators = realloc(rigidbody->torque_generators,
+      sizeof(struct TorqueGenerator) * 1);
+
+    rigidbody->torque_generators[0] =
+      BASIC_TORQUE_GENERATOR;
+
+    rigidbody->torque_generators[0].generator_data = malloc(
+      sizeof(struct BasicTorqueGeneratorData));
+
+    memcpy(rigidbody->torque_generators[0].generator_data,
+      &(struct BasicTorqueGeneratorData){
+        .r = malloc(sizeof(vec3)),
+        .force = malloc(sizeof(vec3)),
+      }, sizeof(struct BasicTorqueGeneratorData));
+
+    rigidbody->torque_generator_count = 1;
+  }
+
+  struct BasicTorqueGeneratorData* tg_data =
+    rigidbody->torque_generators[0].generator_data;
+
+  glm_vec3_copy(data, *tg_data->r);
+
+  glm_vec3_copy((float*)GRAVITY_VEC, *tg_data->force);
+}
+
+/*
+ * Data shared between the systems of main that does not live in the
+ * world, each one is guarded by a RESOURCE_BIT in the systems' access
+ * masks
+ * */
+enum FrameResource {
+  FR_VIEW,
+  FR_LIGHTS,
+  FR_DEBUG_DRAW,
+};
+
+/*
+ * State of the systems of main, passed to each of them as System.data
+ * */
+struct Frame {
+  GLFWwindow* window;
+  int* framebuffer_size;
+
+  EntityId camera;
+  vec3 front;
+  vec3 right;
+  vec3 up;
+
+  /*
+   * Per-frame shader data, filled by the camera and light systems and
+   * uploaded once per frame by the render system
+   * */
+  struct CameraBlock camera_block;
+  struct LightingBlock lighting_block;
+  struct UniformBuffer camera_buffer;
+  struct UniformBuffer lighting_buffer;
+
+  /*
+   * Debug lines and points, appended by the physics system (contacts) and
+   * the render system (colliders), drawn and cleared by the render system
+   * */
+  struct DebugDraw debug_draw;
+
+  /*
+   * Lit and unlit programs, one variant per set of material features
+   * */
+  struct ShaderVariants lit_shaders;
+  struct ShaderVariants unlit_shaders;
+
+  /*
+   * Plain unlit program, linked before the first frame and drawn with
+   * until a material's variant is ready
+   * */
+  struct Program fallback_program;
+
+  /*
+   * Writes nothing but depth, for the depth pre-pass
+   * */
+  struct Program depth_program;
+
+  struct Program debug_program;
+
+  struct RenderQueue render_queue;
+  struct InstanceBuffer instances;
+
+  /*
+   * Point and spot lights binned by the light system, uploaded by the
+   * render system
+   * */
+  struct ClusterGrid clusters;
+
+  /*
+   * Every GL state change of the systems goes through it
+   * */
+  struct GLState gl_state;
+
+  /*
+   * Samples shaded with and without the depth pre-pass
+   * */
+  struct OverdrawStats overdraw;
+
+  struct Query render_query;
+  struct Query body_query;
+  struct Query collider_query;
+
+  struct TransformHierarchy hierarchy;
+
+  struct System* physics;
+};
+
+/*
+ * Update: input, camera vectors and matrices
+ * Polls GLFW, so it stays on the main thread
+ * */
+void camera_system(
+  struct World* world,
+  struct System* system,
+  float delta_time
+) {
+  (void)delta_time;
+
+  struct Frame* frame = system->data;
+  GLFWwindow* window = frame->window;
+
+  struct ComponentCamera* camera_data =
+    world_get_component(world, frame->camera, CK_CAMERA);
+  struct ComponentTransform* cam_transform =
+    world_get_component(world, frame->camera, CK_TRANSFORM);
+  if (camera_data == NULL || cam_transform == NULL) return;
+
+  if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    glfwSetWindowShouldClose(window, 1);
+
+#ifdef DEBUG
+  vec3 translation = {0.0f, 0.0f, 0.0f};
+  if (glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS)
+    glm_vec3_muladds(frame->up, -0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+    glm_vec3_muladds(frame->up, 0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    glm_vec3_muladds(frame->front, 0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    glm_vec3_muladds(frame->front, -0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    glm_vec3_muladds(frame->right, -0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    glm_vec3_muladds(frame->right, 0.1f, translation);
+
+  if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+    frame->physics->is_enabled = !frame->physics->is_enabled;
+
+  if (!glm_vec3_eq(translation, 0.0f)) {
+    glm_vec3_add(cam_transform->position, translation,
+      cam_transform->position);
+    world_stamp_changed(world, frame->camera, CK_TRANSFORM,
+      system->this_run);
+  }
+#endif
+
+  if (world_changed_since(world, frame->camera, CK_TRANSFORM,
+      system->last_run)) {
+    vec3 rotated_front;
+    glm_vec3_copy((float*)WORLD_FORWARD, rotated_front);
+
+    glm_vec3_rotate(rotated_front,
+      cam_transform->rotation[0], (float*)POS_X_AXIS);
+    glm_vec3_rotate(rotated_front,
+      cam_transform->rotation[1], (float*)POS_Y_AXIS);
+    glm_vec3_rotate(rotated_front,
+      cam_transform->rotation[2], (float*)POS_Z_AXIS);
+
+    update_camera_vectors(rotated_front, frame->right, frame->up);
+    glm_vec3_copy(rotated_front, frame->front);
+  }
+
+  vec3 target;
+  glm_vec3_add(cam_transform->position, frame->front, target);
+  glm_lookat(cam_transform->position, target, frame->up,
+    frame->camera_block.view);
+  glm_vec4(cam_transform->position, 1.0f, frame->camera_block.view_pos);
+
+  float vp_w = camera_data->viewport_rect[2] * frame->framebuffer_size[0];
+  float vp_h = camera_data->viewport_rect[3] * frame->framebuffer_size[1];
+
+  float aspect = vp_w / vp_h;
+  glm_perspective(camera_data->fovy, aspect,
+    camera_data->near, camera_data->far, frame->camera_block.projection);
+}
+
+/*
+ * FixedUpdate: integrates rigidbodies and resolves box collisions
+ * Torque changes are recorded as commands, contact lines are handed to
+ * the render system
+ * */
+void physics_system(
+  struct World* world,
+  struct System* system,
+  float delta_time
+) {
+  struct Frame* frame = system->data;
+
+  struct QueryIter it;
+  for (query_iter(world, &frame->body_query, &it); query_next(&it);) {
+    struct Archetype* archetype = it.archetype;
+    struct Chunk* chunk = it.chunk;
+
+    struct ComponentRigidbody* rigidbodies =
+      chunk_column(archetype, chunk, CK_RIGIDBODY);
+    struct ComponentTransform* transforms =
+      chunk_column(archetype, chunk, CK_TRANSFORM);
+    struct ComponentBoxCollider* box_colliders =
+      chunk_column(archetype, chunk, CK_BOX_COLLIDER);
+
+    for (unsigned int row = 0; row < chunk->count; row++) {
+      struct ComponentRigidbody* rigidbody = &rigidbodies[row];
+      struct ComponentTransform* transform = &transforms[row];
+
+      if (rigidbody->is_kinematic) continue;
+
+      for (int i = 0; i < rigidbody->force_generator_count; i++) {
+        struct ForceGenerator* fg =
+            &rigidbody->force_generators[i];
+        fg->update_force(rigidbody, delta_time, fg->generator_data);
+      }
+
+      for (int i = 0; i < rigidbody->torque_generator_count; i++) {
+        struct TorqueGenerator* tg =
+            &rigidbody->torque_generators[i];
+        tg->update_torque(rigidbody, delta_time, tg->generator_data);
+      }
+
+      integrate_entity(transform, rigidbody, delta_time);
+      chunk_mark_changed(archetype, chunk, CK_TRANSFORM, row,
+        system->this_run);
+      chunk_mark_changed(archetype, chunk, CK_RIGIDBODY, row,
+        system->this_run);
+
+      // colliders below read the body's new pose this same frame
+      transform_compute_world(world, transform);
+
+      if (box_colliders == NULL) continue;
+      struct ComponentBoxCollider* a_box_collider = &box_colliders[row];
+
+      struct QueryIter it_b;
+      for (query_iter(world, &frame->collider_query, &it_b);
+           query_next(&it_b);) {
+        struct Archetype* archetype_b = it_b.archetype;
+        struct Chunk* chunk_b = it_b.chunk;
+
+        struct ComponentTransform* b_transforms =
+          chunk_column(archetype_b, chunk_b, CK_TRANSFORM);
+        struct ComponentBoxCollider* b_box_colliders =
+          chunk_column(archetype_b, chunk_b, CK_BOX_COLLIDER);
+
+        for (unsigned int row_b = 0; row_b < chunk_b->count; row_b++) {
+          if (chunk_b->entities[row_b] == chunk->entities[row])
+            continue;
+
+          struct ComponentTransform* b_transform = &b_transforms[row_b];
+          struct ComponentBoxCollider* b_box_collider =
+            &b_box_colliders[row_b];
+
+          struct CollisionManifold manifold;
+          box_and_box_collision(
+            a_box_collider,
+            transform,
+            b_box_collider,
+            b_transform,
+            &manifold
+          );
+          if (!manifold.is_colliding) continue;
+
+          glm_vec3_muladds(
+            manifold.normal,
+            manifold.penetration_depth,
+            transform->position
+          );
+          transform_compute_world(world, transform);
+
+          float speed_along_normal =
+            glm_vec3_dot(rigidbody->velocity, manifold.normal);
+          if (speed_along_normal >= 0.0f) continue;
+
+          vec3 impulse;
+          glm_vec3_scale(manifold.normal,
+            -speed_along_normal * rigidbody->mass,
+            impulse);
+
+          glm_vec3_muladds(impulse,
+            1 / rigidbody->mass,
+            rigidbody->velocity);
+          DISPLAY_VEC3(rigidbody->velocity);
+
+          vec3 center;
+          glm_vec3_zero(center);
+
+          vec3 points[8];
+          get_collider_obb(
+            a_box_collider,
+            transform,
+            points
+          );
+
+          for (int i = 0; i < 8; i++) {
+            glm_vec3_add(center, points[i], center);
+          }
+          glm_vec3_scale(center, 1.0f / 8.0f, center);
+
+          vec3 r;
+          glm_vec3_sub(
+            center,
+            manifold.contact_point,
+            r
+          );
+
+          DISPLAY_VEC3(r);
+          DISPLAY_VEC3(impulse);
+
+          vec3 angular_impulse;
+          // glm_vec3_cross(r, impulse, angular_impulse);
+          glm_vec3_cross(r, impulse, angular_impulse);
+
+          DISPLAY_VEC3(angular_impulse);
+          // angular_impulse[2] = -angular_impulse[2];
+
+          glm_vec3_muladds(angular_impulse,
+            1 / rigidbody->mass,
+            rigidbody->angular_vel);
+
+          // flushed by the render system, GL is only used on the main
+          // thread
+          vec3 contact_end;
+          glm_vec3_add(manifold.contact_point, r, contact_end);
+          debug_draw_line(&frame->debug_draw, contact_end,
+            manifold.contact_point, (vec3){1.0f, 1.0f, 1.0f});
+
+          command_buffer_custom(&system->commands,
+            chunk->entities[row], apply_contact_torque,
+            r, sizeof(vec3));
+        }
+      }
+    }
+  }
+}
+
+/*
+ * LateUpdate: brings world matrices up to date before rendering
+ * */
+void transform_system(
+  struct World* world,
+  struct System* system,
+  float delta_time
+) {
+  (void)delta_time;
+
+  struct Frame* frame = system->data;
+  transform_hierarchy_run(world, &frame->hierarchy, system->this_run);
+}
+
+/*
+ * LateUpdate: gathers the enabled directional lights of the frame, and
+ * bins point and spot lights into the camera's clusters
+ * */
+void light_system(
+  struct World* world,
+  struct System* system,
+  float delta_time
+) {
+  (void)delta_time;
+
+  struct Frame* frame = system->data;
+  struct ComponentPool* light_pool = world_pool(world, CK_LIGHT);
+  struct ComponentLight* lights = (struct ComponentLight*)light_pool->data;
+
+  struct LightingBlock* lighting = &frame->lighting_block;
+  lighting->num_dir_lights = 0;
+
+  struct ClusterGrid* clusters = &frame->clusters;
+  cluster_grid_clear(clusters);
+
+  for (unsigned int i = 0; i < light_pool->count; i++) {
+    if (!light_pool->enabled[i]) continue;
+
+    if (lights[i].light_kind == LK_DIRECTIONAL) {
+      if (lighting->num_dir_lights >= MAX_DIR_LIGHTS) continue;
+
+      directional_light_block(&lights[i],
+        &lighting->directional_lights[lighting->num_dir_lights++]);
+      continue;
+    }
+
+    struct ComponentTransform* transform =
+      world_get_component(world, light_pool->entities[i], CK_TRANSFORM);
+    if (transform == NULL) continue;
+
+    cluster_grid_add_light(clusters, &lights[i], transform->world_matrix[3]);
+  }
+
+  struct ComponentCamera* camera_data =
+    world_get_component(world, frame->camera, CK_CAMERA);
+
+  // nothing is rendered without a camera
+  if (camera_data == NULL) return;
+
+  cluster_grid_build(clusters, frame->camera_block.view,
+    frame->camera_block.projection, camera_data->near, camera_data->far);
+
+  lighting->cluster_size[0] = CLUSTER_X;
+  lighting->cluster_size[1] = CLUSTER_Y;
+  lighting->cluster_size[2] = CLUSTER_Z;
+  lighting->cluster_size[3] = clusters->light_count;
+
+  glm_vec4_zero(lighting->cluster_depth);
+  lighting->cluster_depth[0] = clusters->depth_scale;
+  lighting->cluster_depth[1] = clusters->depth_bias;
+
+  for (int i = 0; i < 4; i++) {
+    lighting->cluster_viewport[i] = camera_data->viewport_rect[i] *
+      frame->framebuffer_size[i % 2];
+  }
+}
+
+struct ShaderVariants* material_variants(
+  struct Frame* frame,
+  struct Material* material
+) {
+  return material->material_shader == MS_LIT
+    ? &frame->lit_shaders
+    : &frame->unlit_shaders;
+}
+
+/*
+ * Program drawing `material`: its shader variant once built, the fallback
+ * program until then
+ * */
+struct Program* material_program(
+  struct Frame* frame,
+  struct Material* material
+) {
+  struct Program* program = shader_variants_get(
+    material_variants(frame, material), material_shader_features(material));
+
+  return program != NULL ? program : &frame->fallback_program;
+}
+
+/*
+ * Passes over the render queue, each drawing part of its packets in
+ * queue order
+ * */
+enum QueuePass {
+  // depth only, with the depth program, for the depth pre-pass
+  QP_DEPTH,
+
+  // opaque packets the pre-pass covers, shaded where their depth matches
+  QP_PREPASSED,
+
+  // the same packets without a pre-pass
+  QP_OPAQUE,
+
+  // everything else: alpha clipped and transparent packets
+  QP_REMAINING,
+};
+
+/*
+ * Whether the depth pre-pass covers a material. Alpha clipped materials
+ * discard fragments the pre-pass cannot know about, and transparent ones
+ * do not hide what is behind them
+ * */
+GLboolean material_is_prepassed(struct Material* material) {
+  return material->surface_type == MST_OPAQUE && !material->is_alpha_clipping;
+}
+
+GLboolean _queue_pass_includes(enum QueuePass pass, struct DrawPacket* packet) {
+  return material_is_prepassed(packet->material) == (pass != QP_REMAINING);
+}
+
+/*
+ * Issues the queue's packets that belong to `pass`, the instance buffer
+ * must hold the queue's instances in queue order
+ * */
+void draw_queue(struct Frame* frame, enum QueuePass pass) {
+  struct RenderQueue* queue = &frame->render_queue;
+  struct GLState* gl_state = &frame->gl_state;
+
+  struct Program* current_program = NULL;
+  struct Material* current_material = NULL;
+
+  if (pass == QP_DEPTH) {
+    gl_state_use_program(gl_state, frame->depth_program.id);
+    gl_state_color_mask(gl_state, GL_FALSE);
+
+    gl_state_set_enabled(gl_state, GSC_BLEND, GL_FALSE);
+    gl_state_set_enabled(gl_state, GSC_CULL_FACE, GL_TRUE);
+    gl_state_cull_face(gl_state, GL_BACK);
+
+    gl_state_depth_mask(gl_state, GL_TRUE);
+    gl_state_depth_func(gl_state, GL_LESS);
+  } else if (pass == QP_PREPASSED) {
+    // the pre-pass already wrote the final depth
+    gl_state_depth_mask(gl_state, GL_FALSE);
+    gl_state_depth_func(gl_state, GL_EQUAL);
+  }
+
+  for (unsigned int first = 0; first < queue->count;) {
+    struct DrawPacket* packet = render_queue_packet(queue, first);
+    if (!_queue_pass_includes(pass, packet)) {
+      first++;
+      continue;
+    }
+
+    // consecutive packets with the same state become one instanced draw,
+    // the depth pass only needs the same mesh
+    unsigned int last = first + 1;
+    while (last < queue->count) {
+      struct DrawPacket* next = render_queue_packet(queue, last);
+      if (!_queue_pass_includes(pass, next) ||
+          !mesh_filter_same_mesh(next->mesh_filter, packet->mesh_filter))
+        break;
+
+      if (pass != QP_DEPTH && (next->program != packet->program ||
+          next->material != packet->material))
+        break;
+
+      last++;
+    }
+
+    // material uniforms belong to the program, resend them on a switch
+    if (pass != QP_DEPTH && packet->program != current_program) {
+      current_program = packet->program;
+      current_material = NULL;
+      gl_state_use_program(gl_state, current_program->id);
+    }
+
+    if (pass != QP_DEPTH && packet->material != current_material) {
+      current_material = packet->material;
+      uniform_material(gl_state, current_program, *current_material);
+      apply_material_state(gl_state, current_material,
+        pass == QP_PREPASSED);
+    }
+
+    gl_state_bind_vertex_array(gl_state, packet->mesh_filter->vao);
+
+    instance_buffer_bind(&frame->instances, first);
+    mesh_draw_instanced(packet->mesh_filter, last - first);
+
+    first = last;
+  }
+
+  if (pass == QP_DEPTH)
+    gl_state_color_mask(gl_state, GL_TRUE);
+}
+
+/*
+ * LateUpdate: draws every mesh renderer from the camera's point of view
+ * */
+void render_system(
+  struct World* world,
+  struct System* system,
+  float delta_time
+) {
+  (void)delta_time;
+
+  struct Frame* frame = system->data;
+
+  struct ComponentCamera* camera_data =
+    world_get_component(world, frame->camera, CK_CAMERA);
+  if (camera_data == NULL) return;
+
+  shader_variants_poll(&frame->lit_shaders);
+  shader_variants_poll(&frame->unlit_shaders);
+
+  uniform_buffer_update(&frame->camera_buffer, &frame->camera_block);
+  uniform_buffer_update(&frame->lighting_buffer, &frame->lighting_block);
+
+  float width = frame->framebuffer_size[0];
+  float height = frame->framebuffer_size[1];
+
+  float vp_x = camera_data->viewport_rect[0] * width;
+  float vp_y = camera_data->viewport_rect[1] * height;
+  float vp_w = camera_data->viewport_rect[2] * width;
+  float vp_h = camera_data->viewport_rect[3] * height;
+
+  struct GLState* gl_state = &frame->gl_state;
+
+  cluster_grid_upload(&frame->clusters);
+  gl_state_bind_texture(gl_state, CLUSTER_LIGHTS_UNIT, GL_TEXTURE_BUFFER,
+    frame->clusters.light_texture);
+  gl_state_bind_texture(gl_state, CLUSTER_GRID_UNIT, GL_TEXTURE_BUFFER,
+    frame->clusters.grid_texture);
+  gl_state_bind_texture(gl_state, CLUSTER_INDICES_UNIT, GL_TEXTURE_BUFFER,
+    frame->clusters.index_texture);
+
+  gl_state_set_enabled(gl_state, GSC_SCISSOR_TEST, GL_TRUE);
+  glScissor(vp_x, vp_y, vp_w, vp_h);
+
+  switch (camera_data->background_kind) {
+    case CBK_COLOR:
+      glClearColor(
+        camera_data->background_data.color[0],
+        camera_data->background_data.color[1],
+        camera_data->background_data.color[2],
+        camera_data->background_data.color[3]
+      );
+      break;
+    case CBK_SKYBOX:
+      break;
+  }
+
+  // glClear honours the write masks, the previous frame may leave them off
+  gl_state_color_mask(gl_state, GL_TRUE);
+  gl_state_depth_mask(gl_state, GL_TRUE);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  gl_state_set_enabled(gl_state, GSC_SCISSOR_TEST, GL_FALSE);
+
+  glad_glViewport(vp_x, vp_y, vp_w, vp_h);
+
+  struct RenderQueue* queue = &frame->render_queue;
+  render_queue_clear(queue);
+
+  float depth_range = camera_data->far - camera_data->near;
+
+  mat4 view_projection;
+  glm_mat4_mul(frame->camera_block.projection, frame->camera_block.view,
+    view_projection);
+
+  struct Frustum frustum;
+  frustum_init(&frustum, view_projection);
+
+  struct QueryIter it;
+  for (query_iter(world, &frame->render_query, &it); query_next(&it);) {
+    struct Archetype* archetype = it.archetype;
+    struct Chunk* chunk = it.chunk;
+
+    struct ComponentMeshRenderer* mesh_renderers =
+      chunk_column(archetype, chunk, CK_MESH_RENDERER);
+    struct ComponentMeshFilter* mesh_filters =
+      chunk_column(archetype, chunk, CK_MESH_FILTER);
+    struct ComponentTransform* transforms =
+      chunk_column(archetype, chunk, CK_TRANSFORM);
+
+    uint8_t visible[CHUNK_CAPACITY];
+    frustum_cull_mesh_filters(&frustum, mesh_filters, chunk->count, visible);
+
+    for (unsigned int row = 0; row < chunk->count; row++) {
+      if (!(chunk->enabled[row] & CK_BIT(CK_MESH_RENDERER))) continue;
+      if (!visible[row]) continue;
+
+      struct ComponentMeshRenderer *mesh_renderer = &mesh_renderers[row];
+      struct ComponentMeshFilter* mesh_filter = &mesh_filters[row];
+      struct ComponentTransform *transform = &transforms[row];
+
+      struct Material* materials = *mesh_renderer->materials;
+      if (materials == NULL || mesh_renderer->material_count == 0) continue;
+
+      // view space depth of the mesh origin
+      vec3 view_pos;
+      glm_mat4_mulv3(frame->camera_block.view, transform->world_matrix[3],
+        1.0f, view_pos);
+      float depth = (-view_pos[2] - camera_data->near) / depth_range;
+
+      for (unsigned int i = 0; i < mesh_renderer->material_count; i++) {
+        struct Material* material = &materials[i];
+
+        // camera and lights come from the per-frame uniform blocks
+        struct DrawPacket packet = {
+          .program = material_program(frame, material),
+          .material = material,
+          .mesh_filter = mesh_filter,
+          .model = transform->world_matrix,
+          .normal_matrix = transform->normal_matrix,
+        };
+
+        GLboolean is_transparent =
+          material->surface_type == MST_TRANSPARENT ? GL_TRUE : GL_FALSE;
+
+        render_queue_push(queue,
+          render_key(mesh_renderer->layer, is_transparent, &packet, depth),
+          packet);
+      }
+    }
+  }
+
+  render_queue_sort(queue);
+
+  // instances are laid out in draw order, one range per batch
+  struct InstanceBuffer* instances = &frame->instances;
+  instance_buffer_clear(instances);
+
+  for (unsigned int i = 0; i < queue->count; i++) {
+    struct DrawPacket* packet = render_queue_packet(queue, i);
+    instance_buffer_push(instances, packet->model, packet->normal_matrix);
+  }
+  instance_buffer_upload(instances);
+
+  gl_state_polygon_mode(gl_state, DEFAULT_RENDER_MODE);
+
+  struct OverdrawStats* overdraw = &frame->overdraw;
+  GLboolean is_prepass = camera_data->is_depth_prepass;
+  overdraw_stats_begin_frame(overdraw, is_prepass);
+
+  if (is_prepass) {
+    overdraw_stats_begin(overdraw, OQ_DEPTH);
+    draw_queue(frame, QP_DEPTH);
+    overdraw_stats_end();
+  }
+
+  overdraw_stats_begin(overdraw, OQ_SHADED);
+  draw_queue(frame, is_prepass ? QP_PREPASSED : QP_OPAQUE);
+  overdraw_stats_end();
+
+  draw_queue(frame, QP_REMAINING);
+
+  overdraw_stats_end_frame(overdraw);
+
+#ifdef SHOW_COLLIDERS
+  struct DebugDraw* debug_draw = &frame->debug_draw;
+
+  for (query_iter(world, &frame->render_query, &it); query_next(&it);) {
+    struct Archetype* archetype = it.archetype;
+    struct Chunk* chunk = it.chunk;
+
+    struct ComponentTransform* transforms =
+      chunk_column(archetype, chunk, CK_TRANSFORM);
+    struct ComponentBoxCollider* box_colliders =
+      chunk_column(archetype, chunk, CK_BOX_COLLIDER);
+    if (box_colliders == NULL) continue;
+
+    for (unsigned int row = 0; row < chunk->count; row++) {
+      if (!(chunk->enabled[row] & CK_BIT(CK_MESH_RENDERER))) continue;
+
+      vec3 corners[8];
+      get_collider_obb(&box_colliders[row], &transforms[row], corners);
+
+      debug_draw_box(debug_draw, corners, (vec3){0.0f, 1.0f, 0.0f});
+      for (int i = 0; i < 8; i++)
+        debug_draw_point(debug_draw, corners[i], (vec3){0.0f, 1.0f, 0.0f});
+
+#ifdef SHOW_COLLIDERS_CENTER
+      vec3 center;
+      glm_vec3_zero(center);
+      for (int i = 0; i < 8; i++) {
+        glm_vec3_add(center, corners[i], center);
+      }
+      glm_vec3_scale(center, 1.0f / 8.0f, center);
+
+      debug_draw_point(debug_draw, center, (vec3){0.0f, 0.0f, 1.0f});
+#endif
+    }
+  }
+#endif
+
+  debug_draw_flush(&frame->debug_draw, gl_state, frame->debug_program.id);
+}
+
 int main(void) {
   float delta_time = 1.0f / FRAME_RATE;
 
@@ -579,37 +1324,77 @@ int main(void) {
   glfwMakeContextCurrent(window);
   gladLoadGL();
 
-  GLuint vertex_shader = load_shader("src/main.vert", GL_VERTEX_SHADER);
-  GLuint lit_frag_shader = load_shader("src/lit.frag", GL_FRAGMENT_SHADER);
-  GLuint unlit_frag_shader = load_shader("src/unlit.frag", GL_FRAGMENT_SHADER);
-  GLuint collider_vert_shader = load_shader("src/collider.vert", GL_VERTEX_SHADER);
-  GLuint collider_frag_shader = load_shader("src/collider.frag", GL_FRAGMENT_SHADER);
-
-  GLuint lit_program = glCreateProgram();
-  glAttachShader(lit_program, vertex_shader);
-  glAttachShader(lit_program, lit_frag_shader);
-  glLinkProgram(lit_program);
-
-  GLuint unlit_program = glCreateProgram();
-  glAttachShader(unlit_program, vertex_shader);
-  glAttachShader(unlit_program, unlit_frag_shader);
-  glLinkProgram(unlit_program);
-
-  GLuint collider_program = glCreateProgram();
-  glAttachShader(collider_program, collider_vert_shader);
-  glAttachShader(collider_program, collider_frag_shader);
-  glLinkProgram(collider_program);
-
-  glDeleteShader(vertex_shader);
-  glDeleteShader(lit_frag_shader);
-  glDeleteShader(unlit_frag_shader);
-  glDeleteShader(collider_vert_shader);
-  glDeleteShader(collider_frag_shader);
+  // linked programs are kept on disk, warm starts skip GLSL compilation
+  struct ProgramCache program_cache;
+  program_cache_init(&program_cache, PROGRAM_CACHE_DIRECTORY);
+
+  char* vertex_source = NULL;
+  char* lit_frag_source = NULL;
+  char* unlit_frag_source = NULL;
+  char* debug_vert_source = NULL;
+  char* debug_frag_source = NULL;
+  char* depth_frag_source = NULL;
+  read_file("src/main.vert", &vertex_source);
+  read_file("src/lit.frag", &lit_frag_source);
+  read_file("src/unlit.frag", &unlit_frag_source);
+  read_file("src/debug.vert", &debug_vert_source);
+  read_file("src/debug.frag", &debug_frag_source);
+  read_file("src/depth.frag", &depth_frag_source);
+
+  struct Program debug_program;
+  GLboolean is_debug_linked = program_cache_link(&program_cache,
+    &debug_program, debug_vert_source, debug_frag_source, 0);
+
+  free(debug_vert_source);
+  free(debug_frag_source);
+
+  if (!is_debug_linked) {
+    fprintf(stderr, "Failed to build the debug program\n");
+    glfwTerminate();
+    return -1;
+  }
+
+  // drawn with until material variants are ready, so it is waited on
+  // like the fixed debug and depth programs
+  struct Program fallback_program;
+  if (!program_cache_link(&program_cache, &fallback_program,
+      vertex_source, unlit_frag_source, 0)) {
+    fprintf(stderr, "Failed to build the fallback program\n");
+    glfwTerminate();
+    return -1;
+  }
+
+  // without it the pre-passed opaque pass would match no depth at all
+  struct Program depth_program;
+  GLboolean is_depth_linked = program_cache_link(&program_cache,
+    &depth_program, vertex_source, depth_frag_source, 0);
+  free(depth_frag_source);
+
+  if (!is_depth_linked) {
+    fprintf(stderr, "Failed to build the depth program\n");
+    glfwTerminate();
+    return -1;
+  }
+
+  // lit and unlit variants are built in the background, vertex_source
+  // stays owned here and is freed after both variant sets
+  struct ShaderVariants lit_shaders, unlit_shaders;
+  shader_variants_init(&lit_shaders, &program_cache, vertex_source,
+    lit_frag_source,
+    SF_BASE_MAP_TEXTURE | SF_ALPHA_CLIPPING | SF_PRESERVE_SPEC_HIGH |
+      SF_TRANSPARENT | SF_SPECULAR_MAP,
+    lit_program_on_link);
+  shader_variants_init(&unlit_shaders, &program_cache, vertex_source,
+    unlit_frag_source, SF_BASE_MAP_TEXTURE, NULL);
 
   // struct Texture box = load_texture("assets/textures/box.jpg");
   // struct Texture knob = load_texture("assets/textures/knob.png");
 
-  const GLuint CUBE_VAO = cube_vao();
+  struct MeshManager meshes;
+  mesh_manager_init(&meshes);
+
+  struct ComponentMeshFilter cube_mesh;
+  mesh_manager_add_cube(&meshes, VERTEX_FORMAT_COMPACT, &cube_mesh);
 
   struct Material mat1 = {
     .material_shader = MS_LIT,
@@ -640,131 +1425,99 @@ int main(void) {
   rgba_to_vec4(255, 0, 0, 255,
                &mat2.base_map_texture->color);
 
-  struct Entity platform = empty_entity();
-  platform.name = "Platform";
+  struct World world;
+  world_init(&world);
+
+  // set up before spawning so prefab instances can be parented
+  struct TransformHierarchy hierarchy;
+  transform_hierarchy_init(&hierarchy);
+
+  /*
+   * Instances of a prefab share its material arrays and generators,
+   * only the components themselves are copied per instance
+   * */
+  struct Prefab platform_prefab;
+  prefab_init(&platform_prefab, "Platform");
 
   struct Material* platform_mats = malloc(1 * sizeof(struct Material));
   platform_mats[0] = mat1;
 
-  add_component(&platform, (struct Component){
-    .kind = CK_TRANSFORM,
-    .is_enabled = GL_TRUE,
-    .data.transform = &(struct ComponentTransform){
+  prefab_set_component(&platform_prefab, CK_TRANSFORM,
+    &(struct ComponentTransform){
       .position = {0.0f, 0.0f, 0.0f},
       .rotation = {0.0f, 0.0f, 0.0f},
       .scale = {5.0f, 1.0f, 5.0f},
-    },
-  });
+    });
 
-  add_component(&platform, (struct Component){
-    .kind = CK_MESH_FILTER,
-    .is_enabled = GL_TRUE,
-    .data.mesh_filter = &(struct ComponentMeshFilter){
-      .mesh_kind = MFK_CUBE,
-      .vao = CUBE_VAO,
-      .vertex_count = CUBE_VERTEX_COUNT,
-    },
-  });
+  prefab_set_component(&platform_prefab, CK_MESH_FILTER,
+    &cube_mesh);
 
-  add_component(&platform, (struct Component){
-    .kind = CK_MESH_RENDERER,
-    .is_enabled = GL_TRUE,
-    .data.mesh_renderer = &(struct ComponentMeshRenderer){
+  prefab_set_component(&platform_prefab, CK_MESH_RENDERER,
+    &(struct ComponentMeshRenderer){
       .materials = &platform_mats,
       .material_count = 1,
-    },
-  });
+    });
 
-  add_component(&platform, (struct Component){
-    .kind = CK_BOX_COLLIDER,
-    .is_enabled = GL_TRUE,
-    .data.box_collider = &(struct ComponentBoxCollider){
+  prefab_set_component(&platform_prefab, CK_BOX_COLLIDER,
+    &(struct ComponentBoxCollider){
       .size = {5.0f, 1.0f, 5.0f},
       .center = {0.0f, 0.0f, 0.0f},
-    },
-  });
+    });
 
-  struct Entity cube = empty_entity();
-  cube.name = "Cube";
+  struct Prefab cube_prefab;
+  prefab_init(&cube_prefab, "Cube");
 
   struct Material* cube_mats = malloc(1 * sizeof(struct Material));
   cube_mats[0] = mat2;
 
-  add_component(&cube, (struct Component){
-    .kind = CK_TRANSFORM,
-    .is_enabled = GL_TRUE,
-    .data.transform = &(struct ComponentTransform){
+  prefab_set_component(&cube_prefab, CK_TRANSFORM,
+    &(struct ComponentTransform){
       .position = {0.0f, 4.0f, 0.0f},
       .rotation = ROTATION_VEC_DEG(0.0f, 45.0f, 45.0f),
       .scale = {1.0f, 1.0f, 1.0f},
-    },
-  });
+    });
 
-  add_component(&cube, (struct Component){
-    .kind = CK_MESH_FILTER,
-    .is_enabled = GL_TRUE,
-    .data.mesh_filter = &(struct ComponentMeshFilter){
-      .mesh_kind = MFK_CUBE,
-      .vao = CUBE_VAO,
-      .vertex_count = CUBE_VERTEX_COUNT
-    },
-  });
+  prefab_set_component(&cube_prefab, CK_MESH_FILTER,
+    &cube_mesh);
 
-  add_component(&cube, (struct Component){
-    .kind = CK_MESH_RENDERER,
-    .is_enabled = GL_TRUE,
-    .data.mesh_renderer = &(struct ComponentMeshRenderer){
+  prefab_set_component(&cube_prefab, CK_MESH_RENDERER,
+    &(struct ComponentMeshRenderer){
       .materials = &cube_mats,
       .material_count = 1,
-    },
-  });
+    });
 
-  struct Component rb = {
-    .kind = CK_RIGIDBODY,
-    .is_enabled = GL_TRUE,
-    .data.rigidbody = &(struct ComponentRigidbody){
+  // torque generators start out NULL, they are allocated per instance
+  // on first contact (see apply_contact_torque)
+  prefab_set_component(&cube_prefab, CK_RIGIDBODY,
+    &(struct ComponentRigidbody){
       .mass = 1.0f,
       .is_kinematic = GL_FALSE,
       .linear_damping = 1.0f,
       .force_generators = (struct ForceGenerator[]){GRAVITY_GENERATOR},
       .force_generator_count = 1,
+      .torque_generators = NULL,
       .torque_generator_count = 0,
-    },
-  };
-  rb.data.rigidbody->torque_generators = malloc(
-    rb.data.rigidbody->torque_generator_count *
-    sizeof(struct TorqueGenerator)
-  );
+    });
 
-  add_component(&cube, rb);
-
-  add_component(&cube, (struct Component){
-    .kind = CK_BOX_COLLIDER,
-    .is_enabled = GL_TRUE,
-    .data.box_collider = &(struct ComponentBoxCollider){
+  prefab_set_component(&cube_prefab, CK_BOX_COLLIDER,
+    &(struct ComponentBoxCollider){
       .size = {1.0f, 1.0f, 1.0f},
       .center = {0.0f, 0.0f, 0.0f},
-    },
-  });
+    });
 
-  vec3 ambient_color = {0.0f, 0.0f, 1.0f};
+  prefab_instantiate(&world, &hierarchy, &platform_prefab);
+  prefab_instantiate(&world, &hierarchy, &cube_prefab);
 
-  struct Entity light = empty_entity();
-  light.name = "Light";
-  add_component(&light, (struct Component){
-    .kind = CK_TRANSFORM,
-    .is_enabled = GL_TRUE,
-    .data.transform = &(struct ComponentTransform){
+  EntityId light = world_spawn(&world, "Light");
+  world_add_component(&world, light, CK_TRANSFORM,
+    &(struct ComponentTransform){
       .position = {0.0f, 100.0f, -50.0f},
       .rotation = {0.0f, 0.0f, 0.0f},
       .scale = {1.0f, 1.0f, 1.0f},
-    },
-  });
+    });
 
-  add_component(&light, (struct Component){
-    .kind = CK_LIGHT,
-    .is_enabled = GL_TRUE,
-    .data.light = &(struct ComponentLight){
+  world_add_component(&world, light, CK_LIGHT,
+    &(struct ComponentLight){
       .light_kind = LK_DIRECTIONAL,
       .light_data.dir_light = {
         .direction = {0.0f, 0.0f, 1.0f},
@@ -774,612 +1527,189 @@ int main(void) {
       },
       .color = {1.0f, 1.0f, 1.0f},
       .intensity = 64.0f,
-    },
-  });
+    });
+
+  EntityId lamp = world_spawn(&world, "Lamp");
+  world_add_component(&world, lamp, CK_TRANSFORM,
+    &(struct ComponentTransform){
+      .position = {0.0f, 3.0f, 0.0f},
+      .rotation = {0.0f, 0.0f, 0.0f},
+      .scale = {1.0f, 1.0f, 1.0f},
+    });
+
+  world_add_component(&world, lamp, CK_LIGHT,
+    &(struct ComponentLight){
+      .light_kind = LK_POINT,
+      .light_data.point_light = {
+        .range = 8.0f,
+      },
+      .color = {1.0f, 0.8f, 0.6f},
+      .intensity = 2.0f,
+    });
 
-  struct Entity camera = empty_entity();
-  camera.name = "Camera";
-  add_component(&camera, (struct Component){
-    .kind = CK_CAMERA,
-    .is_enabled = GL_TRUE,
-    .data.camera = &(struct ComponentCamera){
+  EntityId camera = world_spawn(&world, "Camera");
+  world_add_component(&world, camera, CK_CAMERA,
+    &(struct ComponentCamera){
       .fovy = PERSP_FOV,
       .near = PERSP_NEAR,
       .far = PERSP_FAR,
       .is_perspective = GL_TRUE,
       .is_display_to_screen = GL_TRUE,
       .viewport_rect = {0.0f, 0.0f, 1.0f, 1.0f},
+      .is_depth_prepass = GL_TRUE,
       .background_kind = CBK_COLOR,
       .background_data.color = {0.2f, 0.2f, 0.2f, 1.0f},
-    },
-  });
+    });
 
-  add_component(&camera, (struct Component){
-    .kind = CK_TRANSFORM,
-    .is_enabled = GL_TRUE,
-    .data.transform = &(struct ComponentTransform){
+  world_add_component(&world, camera, CK_TRANSFORM,
+    &(struct ComponentTransform){
       .position = {0.0f, 2.0f, -10.0f},
       .rotation = {0.0f, 0.0f, 0.0f},
       .scale = {1.0f, 1.0f, 1.0f},
+    });
+
+  struct Frame frame = {
+    .window = window,
+    .front = {0.0f, 0.0f, 1.0f},
+    .lighting_block = {
+      .environment_ambient_color = {0.0f, 0.0f, 1.0f},
+      .num_dir_lights = 0,
     },
-  });
+    .lit_shaders = lit_shaders,
+    .unlit_shaders = unlit_shaders,
+    .fallback_program = fallback_program,
+    .depth_program = depth_program,
+    .debug_program = debug_program,
+    .hierarchy = hierarchy,
+  };
 
-  struct Entity entities[] = {cube, platform, light, camera};
-  size_t entity_count = sizeof(entities) / sizeof(entities[0]);
+  // submit the scene's variants now so they compile while it starts up
+  struct Material* scene_materials[] = {&platform_mats[0], &cube_mats[0]};
+  for (int i = 0; i < 2; i++) {
+    shader_variants_request(material_variants(&frame, scene_materials[i]),
+      material_shader_features(scene_materials[i]));
+  }
 
   float aspect = (float)WIDTH / (float)HEIGHT;
   // float near = 0.1f;
   // float far = 100.0f;
 
-  mat4 view_matrix;
-  mat4 projection;
-
   glm_perspective(PERSP_FOV, aspect,
-    PERSP_NEAR, PERSP_FAR, projection);
+    PERSP_NEAR, PERSP_FAR, frame.camera_block.projection);
 
-  vec3 front = {0.0f, 0.0f, 1.0f};
-  vec3 right, up, target;
+  update_camera_vectors(frame.front, frame.right, frame.up);
 
-  update_camera_vectors(front, right, up);
+  uniform_buffer_init(&frame.camera_buffer, UB_CAMERA,
+    sizeof(struct CameraBlock));
+  uniform_buffer_init(&frame.lighting_buffer, UB_LIGHTING,
+    sizeof(struct LightingBlock));
 
-  glEnable(GL_DEPTH_TEST);
-  glDepthFunc(GL_LESS);
-  glDepthMask(GL_TRUE);
+  gl_state_init(&frame.gl_state);
+  gl_state_set_enabled(&frame.gl_state, GSC_DEPTH_TEST, GL_TRUE);
+  gl_state_depth_func(&frame.gl_state, GL_LESS);
+  gl_state_depth_mask(&frame.gl_state, GL_TRUE);
   glClearDepth(1.0f);
 
+  cluster_grid_init(&frame.clusters);
+  overdraw_stats_init(&frame.overdraw);
+  debug_draw_init(&frame.debug_draw);
+
   int* framebuffer_size = malloc(2 * sizeof(int));
   glfwGetFramebufferSize(window,
     &framebuffer_size[0],
     &framebuffer_size[1]);
+  frame.framebuffer_size = framebuffer_size;
 
   struct Context context = {
-    .projection = &projection,
+    .projection = &frame.camera_block.projection,
     .framebuffer_size = &framebuffer_size,
   };
 
   glfwSetWindowUserPointer(window, &context);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-  struct Component *camera_comp = NULL;
-  struct ComponentCamera* camera_data = NULL;
-  struct ComponentTransform* cam_transform = NULL;
+  query_init(&frame.render_query,
+    CK_BIT(CK_MESH_RENDERER) | CK_BIT(CK_MESH_FILTER) | CK_BIT(CK_TRANSFORM),
+    0);
+  query_init(&frame.body_query,
+    CK_BIT(CK_RIGIDBODY) | CK_BIT(CK_TRANSFORM), 0);
+  query_init(&frame.collider_query,
+    CK_BIT(CK_BOX_COLLIDER) | CK_BIT(CK_TRANSFORM), 0);
+
+  render_queue_init(&frame.render_queue);
+  instance_buffer_init(&frame.instances);
 
-  for (size_t i = 0; i < entity_count; i++) {
-    struct Entity entity = entities[i];
+  struct ComponentPool* camera_pool = world_pool(&world, CK_CAMERA);
 
-    if ((
-      camera_comp = get_comp_by_kind(&entity, CK_CAMERA)
-    ) != NULL) {
-      cam_transform =
-          get_comp_by_kind(
-              &entity, CK_TRANSFORM)
-              ->data.transform;
+  frame.camera = ENTITY_NULL;
 
-      camera_data = camera_comp->data.camera;
+  for (unsigned int i = 0; i < camera_pool->count; i++) {
+    if (world_has_component(&world,
+        camera_pool->entities[i], CK_TRANSFORM)) {
+      frame.camera = camera_pool->entities[i];
       break;
     }
   }
 
-  vec3 previous_rot = {0.0f, 0.0f, 1.0f};
-
-  int is_playing = 1;
-
-  while (!glfwWindowShouldClose(window)) {
-    float width = framebuffer_size[0];
-    float height = framebuffer_size[1];
-
-    if (!glm_vec3_eqv(cam_transform->rotation, previous_rot)) {
-      printf("Camera rotation changed\n");
-      glm_vec3_copy(cam_transform->rotation, previous_rot);
-
-      vec3 rotated_front;
-      glm_vec3_copy(front, rotated_front);
-
-      glm_vec3_rotate(rotated_front,
-        cam_transform->rotation[0], (float*)POS_X_AXIS);
-      glm_vec3_rotate(rotated_front,
-        cam_transform->rotation[1], (float*)POS_Y_AXIS);
-      glm_vec3_rotate(rotated_front,
-        cam_transform->rotation[2], (float*)POS_Z_AXIS);
-
-      update_camera_vectors(rotated_front, right, up);
-      glm_vec3_copy(rotated_front, front);
-    }
-
-    glm_vec3_add(cam_transform->position, front, target);
-    glm_lookat(cam_transform->position, target, up,
-      view_matrix);
-
-    float vp_x = camera_data->viewport_rect[0] * width;
-    float vp_y = camera_data->viewport_rect[1] * height;
-    float vp_w = camera_data->viewport_rect[2] * width;
-    float vp_h = camera_data->viewport_rect[3] * height;
-
-    glEnable(GL_SCISSOR_TEST);
-    glScissor(vp_x, vp_y, vp_w, vp_h);
-
-    switch (camera_data->background_kind) {
-      case CBK_COLOR:
-        glClearColor(
-          camera_data->background_data.color[0],
-          camera_data->background_data.color[1],
-          camera_data->background_data.color[2],
-          camera_data->background_data.color[3]
-        );
-        break;
-      case CBK_SKYBOX:
-        break;
-    }
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glDisable(GL_SCISSOR_TEST);
-
-    glad_glViewport(camera_data->viewport_rect[0] * width,
-      camera_data->viewport_rect[1] * height,
-      camera_data->viewport_rect[2] * width,
-      camera_data->viewport_rect[3] * height);
-
-
-    aspect = vp_w / vp_h;
-    glm_perspective(camera_data->fovy, aspect,
-      camera_data->near, camera_data->far, projection);
-
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-      glfwSetWindowShouldClose(window, 1);
-
-#ifdef DEBUG
-    vec3 translation = {0.0f, 0.0f, 0.0f};
-    if (glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS)
-      glm_vec3_muladds(up, -0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-      glm_vec3_muladds(up, 0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-      glm_vec3_muladds(front, 0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-      glm_vec3_muladds(front, -0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-      glm_vec3_muladds(right, -0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-      glm_vec3_muladds(right, 0.1f, translation);
-
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-      is_playing = !is_playing;
-
-    glm_vec3_add(cam_transform->position, translation,
-      cam_transform->position);
-#endif
-
-    // begin render pipeline
-    int light_count = 0;
-    struct ComponentLight dir_lights[10];
-
-    for (size_t i = 0; i < entity_count; i++) {
-      struct Entity entity = entities[i];
-
-      struct Component *light = NULL;
-      if ((
-        light = get_comp_by_kind(&entity, CK_LIGHT)
-      ) != NULL) {
-        struct ComponentLight *light_comp = light->data.light;
-
-        if (light_comp->light_kind == LK_DIRECTIONAL) {
-          dir_lights[light_count++] = *light_comp;
-        }
-      }
-    }
-
-    for (size_t entity_i = 0; entity_i < entity_count; entity_i++) {
-      struct Entity entity = entities[entity_i];
-
-      struct Component *mesh_r = NULL;
-
-      if ((
-        mesh_r = get_comp_by_kind(&entity, CK_MESH_RENDERER)
-      ) != NULL) {
-        struct ComponentMeshRenderer *mesh_renderer =
-            mesh_r->data.mesh_renderer;
-        if (!mesh_r->is_enabled) continue;
-
-        struct ComponentMeshFilter* mesh_filter =
-            get_comp_by_kind(
-                &entity, CK_MESH_FILTER)->data.mesh_filter;
-        if (mesh_filter == NULL) continue;
-
-        struct ComponentTransform *transform =
-            get_comp_by_kind(
-                &entity, CK_TRANSFORM)->data.transform;
-        if (transform == NULL) continue;
-
-        struct Material* materials = *mesh_renderer->materials;
-        if (materials == NULL || mesh_renderer->material_count == 0) continue;
-
-        mat4 model;
-        glm_mat4_identity(model);
-        glm_translate(model, transform->position);
-        glm_rotate_x(model, transform->rotation[0], model);
-        glm_rotate_y(model, transform->rotation[1], model);
-        glm_rotate_z(model, transform->rotation[2], model);
-        glm_scale(model, transform->scale);
-
-        for (unsigned int i = 0; i < mesh_renderer->material_count; i++) {
-          struct Material material = materials[i];
-
-          GLuint program;
-          if (material.material_shader == MS_LIT) {
-            glUseProgram(lit_program);
-            program = lit_program;
-
-            for (int i = 0; i < light_count; i++) {
-              struct ComponentLight light_comp = dir_lights[i];
-              struct DirLightData dir_light_data =
-                light_comp.light_data.dir_light;
-
-              uniform_directional_light(program, i, dir_light_data,
-                light_comp);
-            }
-
-          } else {
-            glUseProgram(unlit_program);
-            program = unlit_program;
-          }
-
-          GLuint model_loc =
-            glGetUniformLocation(program, "model");
-          glUniformMatrix4fv(model_loc, 1,
-            GL_FALSE, (float *)model);
-          GLuint proj_loc =
-            glGetUniformLocation(program, "projection");
-          glUniformMatrix4fv(proj_loc, 1,
-            GL_FALSE, (float *)projection);
-          GLuint view_loc =
-            glGetUniformLocation(program, "view");
-          glUniformMatrix4fv(view_loc, 1,
-            GL_FALSE, (float *)view_matrix);
-
-          GLuint view_pos_loc =
-            glGetUniformLocation(program, "view_pos");
-
-          GLuint num_dir_lights_loc =
-              glGetUniformLocation(program, "num_dir_lights");
-          glUniform1i(num_dir_lights_loc, light_count);
-
-          GLuint environment_ambient_color_loc =
-              glGetUniformLocation(program, "environment_ambient_color");
-          glUniform3fv(environment_ambient_color_loc, 1,
-            ambient_color);
-
-          glUniform3fv(view_pos_loc, 1,
-            cam_transform->position);
-
-          uniform_material(program, material);
-
-          glDepthMask(GL_TRUE);
-          if (material.surface_type == MST_TRANSPARENT) {
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-            glDepthFunc(GL_LESS);
-
-            switch (material.render_face) {
-              case MRF_FRONT:
-                glEnable(GL_CULL_FACE);
-                glCullFace(GL_BACK);
-                break;
-              case MRF_BACK:
-                glEnable(GL_CULL_FACE);
-                glCullFace(GL_FRONT);
-                break;
-              case MRF_DOUBLE:
-                glDisable(GL_CULL_FACE);
-                break;
-            }
-          } else {
-            glDisable(GL_BLEND);
-
-            glEnable(GL_CULL_FACE);
-            glCullFace(GL_BACK);
-
-            glDisable(GL_POLYGON_OFFSET_FILL);
-
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LEQUAL);
-          }
-        }
-
-        glBindVertexArray(mesh_filter->vao);
-        glPolygonMode(GL_FRONT_AND_BACK, DEFAULT_RENDER_MODE);
-        glDrawArrays(GL_TRIANGLES, 0,
-          mesh_filter->vertex_count);
-
-#ifdef SHOW_COLLIDERS
-        struct Component* box_collider_comp =
-            get_comp_by_kind(
-                &entity, CK_BOX_COLLIDER);
+  struct Scheduler scheduler;
+  scheduler_init(&scheduler, 1.0f / FRAME_RATE);
+
+  scheduler_add_system(&scheduler, (struct System){
+    .name = "Camera",
+    .phase = SP_UPDATE,
+    .reads = CK_BIT(CK_CAMERA),
+    .writes = CK_BIT(CK_TRANSFORM) | RESOURCE_BIT(FR_VIEW),
+    .is_main_thread = GL_TRUE,
+    .run = camera_system,
+    .data = &frame,
+  });
 
-        if (box_collider_comp != NULL) {
-          glUseProgram(collider_program);
+  frame.physics = scheduler_add_system(&scheduler, (struct System){
+    .name = "Physics",
+    .phase = SP_FIXED_UPDATE,
+    .reads = CK_BIT(CK_BOX_COLLIDER),
+    .writes = CK_BIT(CK_TRANSFORM) | CK_BIT(CK_RIGIDBODY) |
+      RESOURCE_BIT(FR_DEBUG_DRAW),
+    .is_main_thread = GL_FALSE,
+    .run = physics_system,
+    .data = &frame,
+  });
 
+  scheduler_add_system(&scheduler, (struct System){
+    .name = "Transform",
+    .phase = SP_LATE_UPDATE,
+    // world bounds of moved mesh filters are refreshed with the matrices
+    .writes = CK_BIT(CK_TRANSFORM) | CK_BIT(CK_MESH_FILTER),
+    .is_main_thread = GL_FALSE,
+    .run = transform_system,
+    .data = &frame,
+  });
 
-#ifdef SHOW_COLLIDERS_CENTER
-          int num_points = 9;
-#else
-          int num_points = 8;
-#endif
-          vec3 points[num_points];
-          get_collider_obb(
-            box_collider_comp->data.box_collider,
-            transform,
-            points
-          );
+  scheduler_add_system(&scheduler, (struct System){
+    .name = "Lights",
+    .phase = SP_LATE_UPDATE,
+    .reads = CK_BIT(CK_LIGHT) | CK_BIT(CK_TRANSFORM) | CK_BIT(CK_CAMERA) |
+      RESOURCE_BIT(FR_VIEW),
+    .writes = RESOURCE_BIT(FR_LIGHTS),
+    .is_main_thread = GL_FALSE,
+    .run = light_system,
+    .data = &frame,
+  });
 
-#ifdef SHOW_COLLIDERS_CENTER
-          vec3 center;
-          glm_vec3_zero(center);
-          for (int i = 0; i < 8; i++) {
-            glm_vec3_add(center, points[i], center);
-          }
-          glm_vec3_scale(center, 1.0f / 8.0f, center);
-          glm_vec3_copy(center, points[8]);
-#endif
+  scheduler_add_system(&scheduler, (struct System){
+    .name = "Render",
+    .phase = SP_LATE_UPDATE,
+    .reads = CK_BIT(CK_MESH_RENDERER) | CK_BIT(CK_MESH_FILTER) |
+      CK_BIT(CK_TRANSFORM) | CK_BIT(CK_BOX_COLLIDER) | CK_BIT(CK_CAMERA) |
+      RESOURCE_BIT(FR_VIEW) | RESOURCE_BIT(FR_LIGHTS),
+    .writes = RESOURCE_BIT(FR_DEBUG_DRAW),
+    .is_main_thread = GL_TRUE,
+    .run = render_system,
+    .data = &frame,
+  });
 
-          for (int i = 0; i < num_points; i++) {
-            mat4 point_model;
-            glm_mat4_identity(point_model);
-            glm_translate(point_model, points[i]);
-            glm_scale(point_model, (vec3){0.1f, 0.1f, 0.1f});
-
-            GLuint model_loc =
-              glGetUniformLocation(collider_program, "model");
-            glUniformMatrix4fv(model_loc, 1,
-              GL_FALSE, (float *)point_model);
-            GLuint proj_loc =
-              glGetUniformLocation(collider_program, "projection");
-            glUniformMatrix4fv(proj_loc, 1,
-              GL_FALSE, (float *)projection);
-            GLuint view_loc =
-              glGetUniformLocation(collider_program, "view");
-            glUniformMatrix4fv(view_loc, 1,
-              GL_FALSE, (float *)view_matrix);
-
-            GLuint color_loc =
-              glGetUniformLocation(collider_program, "color");
-            if (i < 8) {
-              glUniform3fv(color_loc, 1,
-                (vec3){0.0f, 1.0f, 0.0f});
-            } else {
-              glUniform3fv(color_loc, 1,
-                (vec3){0.0f, 0.0f, 1.0f});
-            }
-
-            glBindVertexArray(CUBE_VAO);
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glDrawArrays(GL_TRIANGLES, 0,
-              CUBE_VERTEX_COUNT);
-          }
-        }
-#endif
-      }
-    }
-    // end render pipeline
-    // begin physics engine
-    if (is_playing) {
-      for (size_t i = 0; i < entity_count; i++) {
-        struct Entity* entity = &entities[i];
-
-        struct Component *rigidbody_comp = NULL;
-        struct Component *transform_comp = NULL;
-
-        if ((
-          rigidbody_comp = get_comp_by_kind(entity, CK_RIGIDBODY)
-        ) != NULL && (
-          transform_comp = get_comp_by_kind(entity, CK_TRANSFORM)
-        ) != NULL) {
-          struct ComponentRigidbody* rigidbody =
-              rigidbody_comp->data.rigidbody;
-          struct ComponentTransform* transform =
-              transform_comp->data.transform;
-
-          if (!rigidbody->is_kinematic) {
-            for (int i = 0; i < rigidbody->force_generator_count; i++) {
-              struct ForceGenerator* fg =
-                  &rigidbody->force_generators[i];
-              fg->update_force(rigidbody, delta_time, fg->generator_data);
-            }
-
-            for (int i = 0; i < rigidbody->torque_generator_count; i++) {
-              struct TorqueGenerator* tg =
-                  &rigidbody->torque_generators[i];
-              tg->update_torque(rigidbody, delta_time, tg->generator_data);
-            }
-
-            integrate_entity(transform, rigidbody, delta_time);
-
-            for (size_t j = 0; j < entity_count; j++) {
-              if (i == j) continue;
-
-              struct Entity* entity_b = &entities[j];
-
-              struct Component* b_transform_comp = NULL;
-
-              if ((b_transform_comp =
-                get_comp_by_kind(entity_b, CK_TRANSFORM)
-              ) != NULL) {
-                struct ComponentTransform* b_transform =
-                    b_transform_comp->data.transform;
-
-                struct Component* a_bc_comp =
-                    get_comp_by_kind(entity, CK_BOX_COLLIDER);
-                struct Component* b_bc_comp =
-                    get_comp_by_kind(entity_b, CK_BOX_COLLIDER);
-
-                if (a_bc_comp != NULL && b_bc_comp != NULL) {
-                  struct ComponentBoxCollider* a_box_collider =
-                      a_bc_comp->data.box_collider;
-                  struct ComponentBoxCollider* b_box_collider =
-                      b_bc_comp->data.box_collider;
-
-                  struct CollisionManifold manifold;
-                  box_and_box_collision(
-                    a_box_collider,
-                    transform,
-                    b_box_collider,
-                    b_transform,
-                    &manifold
-                  );
-                  if (manifold.is_colliding) {
-                    glm_vec3_muladds(
-                      manifold.normal,
-                      manifold.penetration_depth,
-                      transform->position
-                    );
-
-                    float speed_along_normal =
-                      glm_vec3_dot(rigidbody->velocity, manifold.normal);
-                    if (speed_along_normal < 0.0f) {
-                      vec3 impulse;
-                      glm_vec3_scale(manifold.normal,
-                        -speed_along_normal * rigidbody->mass,
-                        impulse);
-
-                      glm_vec3_muladds(impulse,
-                        1 / rigidbody->mass,
-                        rigidbody->velocity);
-                      DISPLAY_VEC3(rigidbody->velocity);
-
-                      vec3 center;
-                      glm_vec3_zero(center);
-
-                      vec3 points[8];
-                      get_collider_obb(
-                        a_box_collider,
-                        transform,
-                        points
-                      );
-
-                      for (int i = 0; i < 8; i++) {
-                        glm_vec3_add(center, points[i], center);
-                      }
-                      glm_vec3_scale(center, 1.0f / 8.0f, center);
-
-                      vec3 r;
-                      glm_vec3_sub(
-                        center,
-                        manifold.contact_point,
-                        r
-                      );
-
-                      DISPLAY_VEC3(r);
-                      DISPLAY_VEC3(impulse);
-
-                      vec3 angular_impulse;
-                      // glm_vec3_cross(r, impulse, angular_impulse);
-                      glm_vec3_cross(r, impulse, angular_impulse);
-
-                      DISPLAY_VEC3(angular_impulse);
-                      // angular_impulse[2] = -angular_impulse[2];
-
-                      glm_vec3_muladds(angular_impulse,
-                        1 / rigidbody->mass,
-                        rigidbody->angular_vel);
-
-                      // draw line from contact point in direction of r
-                      GLuint vao, vbo;
-                      glGenVertexArrays(1, &vao);
-                      glGenBuffers(1, &vbo);
-
-                      vec3 line_points[2];
-                      glm_vec3_copy(manifold.contact_point, line_points[1]);
-                      glm_vec3_add(
-                        manifold.contact_point,
-                        r,
-                        line_points[0]
-                      );
-
-                      glBindVertexArray(vao);
-                      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-                      glBufferData(GL_ARRAY_BUFFER,
-                        sizeof(line_points),
-                        line_points,
-                        GL_STATIC_DRAW);
-
-                      glEnableVertexAttribArray(0);
-                      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-                        3 * sizeof(float), (void*)0);
-
-                      glUseProgram(collider_program);
-                      GLuint model_loc =
-                        glGetUniformLocation(collider_program, "model");
-                      mat4 identity;
-                      glm_mat4_identity(identity);
-                      glUniformMatrix4fv(model_loc, 1,
-                        GL_FALSE, (float *)identity);
-                      GLuint proj_loc =
-                        glGetUniformLocation(collider_program, "projection");
-                      glUniformMatrix4fv(proj_loc, 1,
-                        GL_FALSE, (float *)projection);
-                      GLuint view_loc =
-                        glGetUniformLocation(collider_program, "view");
-                      glUniformMatrix4fv(view_loc, 1,
-                        GL_FALSE, (float *)view_matrix);
-                      GLuint color_loc =
-                        glGetUniformLocation(collider_program, "color");
-                      glUniform3fv(color_loc, 1,
-                        (vec3){1.0f, 1.0f, 1.0f});
-                      glBindVertexArray(vao);
-                      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                      glDrawArrays(GL_LINES, 0, 2);
-                      glDeleteVertexArrays(1, &vao);
-                      glDeleteBuffers(1, &vbo);
-                      glPolygonMode(GL_FRONT_AND_BACK, DEFAULT_RENDER_MODE);
-
-                      if (rigidbody->torque_generator_count == 0) {
-                        (void)realloc(rigidbody->torque_generators,
-                          sizeof(struct TorqueGenerator) * 1);
-
-                        rigidbody->torque_generators[0] =
-                          BASIC_TORQUE_GENERATOR;
-
-                        rigidbody->torque_generators[0].generator_data = malloc(
-                          sizeof(struct BasicTorqueGeneratorData));
-
-                        memcpy(rigidbody->torque_generators[0].generator_data,
-                          &(struct BasicTorqueGeneratorData){
-                            .r = malloc(sizeof(vec3)),
-                            .force = malloc(sizeof(vec3)),
-                          }, sizeof(struct BasicTorqueGeneratorData));
-
-                        struct BasicTorqueGeneratorData* tg_data =
-                          rigidbody->torque_generators[0].generator_data;
-
-                        glm_vec3_copy(r, *tg_data->r);
-
-                        glm_vec3_copy((float*)GRAVITY_VEC, *tg_data->force);
-
-                        rigidbody->torque_generator_count = 1;
-                      } else {
-                        struct BasicTorqueGeneratorData* tg_data =
-                          rigidbody->torque_generators[0].generator_data;
-
-                        glm_vec3_copy(r, *tg_data->r);
-
-                        glm_vec3_copy((float*)GRAVITY_VEC, *tg_data->force);
-                      }
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
-      }
-    }
-    // end physics engine
+  while (!glfwWindowShouldClose(window)) {
+    scheduler_update(&scheduler, &world, delta_time);
 
     glfwSwapBuffers(window);
     glfwPollEvents();
@@ -1387,12 +1717,43 @@ int main(void) {
     glfwWaitEventsTimeout(delta_time);
   }
 
+#ifdef DEBUG
+  printf("GL state calls: %lu issued, %lu skipped\n",
+    frame.gl_state.issued_calls, frame.gl_state.skipped_calls);
+  printf("Program cache: %lu hits, %lu misses\n",
+    program_cache.hits, program_cache.misses);
+  overdraw_stats_print(&frame.overdraw);
+#endif
+
+  scheduler_free(&scheduler);
+
   free(framebuffer_size);
+  prefab_free(&cube_prefab);
+  prefab_free(&platform_prefab);
   free(cube_mats);
   free(platform_mats);
-  for (size_t i = 0; i < entity_count; i++) {
-    free(entities[i].components);
-  }
+  transform_hierarchy_free(&frame.hierarchy);
+  render_queue_free(&frame.render_queue);
+  instance_buffer_free(&frame.instances);
+  cluster_grid_free(&frame.clusters);
+  overdraw_stats_free(&frame.overdraw);
+  debug_draw_free(&frame.gl_state, &frame.debug_draw);
+  query_free(&frame.render_query);
+  query_free(&frame.body_query);
+  query_free(&frame.collider_query);
+  world_free(&world);
+
+  uniform_buffer_free(&frame.camera_buffer);
+  uniform_buffer_free(&frame.lighting_buffer);
+
+  mesh_manager_free(&meshes);
+
+  shader_variants_free(&frame.lit_shaders);
+  shader_variants_free(&frame.unlit_shaders);
+  free(vertex_source);
+  program_free(&frame.fallback_program);
+  program_free(&frame.depth_program);
+  program_free(&frame.debug_program);
 
   glfwDestroyWindow(window);
   glfwTerminate();
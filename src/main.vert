@@ -4,18 +4,28 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
 
+// per instance, see instance_buffer.h
+layout(location = 3) in mat4 aModel;
+layout(location = 7) in mat3 aNormalMatrix;
+
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// the depth pre-pass and the shading pass must produce the exact same
+// depth for GL_EQUAL to pass
+invariant gl_Position;
+
+layout(std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+  vec3 view_pos;
+};
 
 void main()
 {
-  FragPos = vec3(model * vec4(aPos, 1.0));
-  Normal = mat3(transpose(inverse(model))) * aNormal;
+  FragPos = vec3(aModel * vec4(aPos, 1.0));
+  Normal = aNormalMatrix * aNormal;
   TexCoords = aTexCoords;
 
   gl_Position = projection * view * vec4(FragPos, 1.0);
@@ -3,7 +3,6 @@
 struct Material {
   vec4 base_map;
   sampler2D base_map_texture;
-  int has_base_map_texture;
   float smoothness;
 };
 
@@ -13,17 +12,19 @@ in vec2 TexCoords;
 
 out vec4 FragColor;
 
-uniform vec3 view_pos;
-
-uniform vec3 environment_ambient_color;
+layout(std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+  vec3 view_pos;
+};
 
 uniform Material material;
 
 void main() {
   vec4 result = material.base_map;
-  if (material.has_base_map_texture == 1) {
-    result *= texture(material.base_map_texture, TexCoords);
-  }
+#ifdef HAS_BASE_MAP_TEXTURE
+  result *= texture(material.base_map_texture, TexCoords);
+#endif
 
   FragColor = result;
 }